@@ -0,0 +1,104 @@
+#!/bin/sh
+# runs a headless master and N slaves on loopback for a fixed number
+# of frames and writes the master's benchmark report as JSON
+#
+# usage: scripts/local_cluster.sh [-n slaves] [-f frames] [-m cuda|simd|single]
+#                                 [-o report.json] [-b path/to/p3] [-p]
+#                                 [-d delay_ms] [-r rate_mbit] [-l]
+#                                 [-s rows|samples|frames]
+#   -p  pin the master and each slave to their own cpu
+#   -l  master renders a share of every frame too
+#   -s  how master divides the work, see -split
+#   -d  add latency to loopback, -r limit its bandwidth.
+#       Both use tc netem on lo and need root, lo is restored on exit
+
+slaves=2
+frames=300
+mode=single
+report=cluster_report.json
+bin=./p3
+pin=0
+delay=
+rate=
+local=
+split=rows
+
+while getopts "n:f:m:o:b:pd:r:ls:" opt; do
+	case $opt in
+	n) slaves=$OPTARG ;;
+	f) frames=$OPTARG ;;
+	m) mode=$OPTARG ;;
+	o) report=$OPTARG ;;
+	b) bin=$OPTARG ;;
+	p) pin=1 ;;
+	d) delay=$OPTARG ;;
+	r) rate=$OPTARG ;;
+	l) local=-local ;;
+	s) split=$OPTARG ;;
+	*) sed -n '2,13p' "$0"; exit 1 ;;
+	esac
+done
+
+if [ ! -x "$bin" ]; then
+	echo "can't find $bin, build and install p3 first or pass -b"
+	exit 1
+fi
+
+cpus=$(nproc)
+pids=
+
+# runs the command pinned to cpu $1 if pinning
+launch() {
+	cpu=$(( $1 % cpus ))
+	shift
+	if [ $pin -eq 1 ]; then
+		taskset -c $cpu "$@" &
+	else
+		"$@" &
+	fi
+}
+
+netem=0
+cleanup() {
+	for pid in $pids; do
+		kill $pid 2>/dev/null
+		# killed slaves leave their shared memory behind
+		rm -f /dev/shm/dracuda_slave_$pid
+	done
+	if [ $netem -eq 1 ]; then
+		tc qdisc del dev lo root 2>/dev/null
+	fi
+}
+trap cleanup EXIT INT TERM
+
+if [ -n "$delay" ] || [ -n "$rate" ]; then
+	args=
+	[ -n "$delay" ] && args="$args delay ${delay}ms"
+	[ -n "$rate" ] && args="$args rate ${rate}mbit"
+	if ! tc qdisc add dev lo root netem $args; then
+		echo "can't shape loopback, tc needs root"
+		exit 1
+	fi
+	netem=1
+fi
+
+launch 0 "$bin" -master "$slaves" "$mode" -headless -frames "$frames" -report "$report" -split "$split" $local
+master_pid=$!
+
+# give the master time to listen
+sleep 1
+
+i=1
+while [ $i -le "$slaves" ]; do
+	launch $i "$bin" -slave 127.0.0.1 "$mode"
+	pids="$pids $!"
+	i=$((i + 1))
+done
+
+wait $master_pid
+ret=$?
+
+if [ $ret -eq 0 ] && [ -f "$report" ]; then
+	cat "$report"
+fi
+exit $ret
@@ -11,9 +11,37 @@
 #include <omp.h>
 #include "math/math.hpp"
 #include "limits.h"
+#include <atomic>
+
+// once random_seed is called, generators start from seeds made of
+// base_seed and their stream instead of the random device
+static std::atomic<bool> fixed_seed(false);
+static std::atomic<unsigned int> base_seed(0);
+
+// spreads close numbers apart, the generator's first numbers
+// from consecutive seeds are nearly the same
+static unsigned int mix(unsigned int x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352d;
+    x ^= x >> 15;
+    x *= 0x846ca68b;
+    x ^= x >> 16;
+    return x;
+}
+
+static unsigned int stream_seed(unsigned int stream)
+{
+    return mix(base_seed + mix(stream));
+}
+
 //initializes the (thread-local) random number generator
 std::default_random_engine *init_rand(){
     std::default_random_engine *ret;
+    // the stream of an OpenMP thread is its number, not
+    // the order in which the threads first draw a number
+    if (fixed_seed)
+        return new std::default_random_engine(stream_seed(omp_get_thread_num()));
     std::uniform_int_distribution<int> dist(0,INT_MAX);
     std::random_device rd;
     ret=new std::default_random_engine(dist(rd));
@@ -52,3 +80,32 @@ real_t random_gaussian()
     return dist(*generator);
 }
 
+/**
+ * Seeds the generator of the calling thread, and of the threads using
+ * theirs for the first time after the call, from seed and their thread number
+ */
+void random_seed(unsigned int seed)
+{
+    base_seed = seed;
+    fixed_seed = true;
+    generator->seed(stream_seed(omp_get_thread_num()));
+}
+
+/**
+ * Restarts the calling thread's generator at its stream, if random_seed was called
+ */
+void random_seed_stream(unsigned int stream)
+{
+    if (fixed_seed)
+        generator->seed(stream_seed(stream));
+}
+
+/**
+ * A seed for a generator of its own, from the seed of random_seed or the random device
+ */
+unsigned int random_generator_seed()
+{
+    if (fixed_seed)
+        return stream_seed(UINT_MAX);
+    return std::random_device()();
+}
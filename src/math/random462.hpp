@@ -20,3 +20,23 @@ float random_gaussian();
      * Generate a uniformly random integer between 0 (incl) and n (excl)
      */
 int random_int(int n);
+
+    /**
+     * Makes the numbers repeat from run to run. The generators of the
+     * threads already using theirs, other than the caller's, go on as they were
+     */
+void random_seed(unsigned int seed);
+
+    /**
+     * Once random_seed was called, restarts the calling thread's generator
+     * at a seed made of stream. What it draws next depends on stream only,
+     * not on which thread draws it. Does nothing otherwise
+     */
+void random_seed_stream(unsigned int stream);
+
+    /**
+     * A seed for a generator of its own, such as the cuda renderer's: made
+     * of the seed given to random_seed once it was called, else a new one
+     * from the random device
+     */
+unsigned int random_generator_seed();
@@ -0,0 +1,236 @@
+#include "bench_report.hpp"
+#include "cycleTimer.h"
+
+#include <algorithm>
+#include <cstdio>
+
+// writes value as a json string, quoted. Labels are host
+// names or given on the command line, they may hold anything
+static void write_string(FILE* file, const std::string& value)
+{
+	fputc('"', file);
+	for(unsigned char c : value)
+	{
+		if(c == '"' || c == '\\') {
+			fprintf(file, "\\%c", c);
+		} else if(c < 0x20) {
+			fprintf(file, "\\u%04x", c);
+		} else {
+			fputc(c, file);
+		}
+	}
+	fputc('"', file);
+}
+
+// writes "name":{"mean":..,"p50":..,"p95":..,"p99":..} in milliseconds
+static void write_stats(FILE* file, const char* name, std::vector<double> samples)
+{
+	double mean = 0, p50 = 0, p95 = 0, p99 = 0;
+
+	if(!samples.empty())
+	{
+		for(double s : samples) {
+			mean += s;
+		}
+		mean /= samples.size();
+
+		std::sort(samples.begin(), samples.end());
+		auto percentile = [&samples](double p) {
+			int rank = std::max(0, std::min((int)samples.size() - 1,
+				(int)(p * samples.size() + 0.999999) - 1));
+			return samples[rank];
+		};
+		p50 = percentile(0.5);
+		p95 = percentile(0.95);
+		p99 = percentile(0.99);
+	}
+
+	fprintf(file, "\"%s\": {\"mean\": %.3f, \"p50\": %.3f, \"p95\": %.3f, \"p99\": %.3f}",
+		name, mean * 1000, p50 * 1000, p95 * 1000, p99 * 1000);
+}
+
+BenchReport::BenchReport()
+	: start_time(0), last_frame_time(0)
+{
+}
+
+void BenchReport::start()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	start_time = CycleTimer::currentSeconds();
+	last_frame_time = start_time;
+	frame_times.clear();
+	for(int i=0;i<MAX_SLAVE;i++) {
+		slaves[i] = SlaveSamples();
+	}
+}
+
+void BenchReport::add_frame()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	double now = CycleTimer::currentSeconds();
+	frame_times.push_back(now - last_frame_time);
+	last_frame_time = now;
+}
+
+void BenchReport::add_response(int slave_idx, double response_duration,
+	double rendering_latency, double network_latency,
+	double queue_time, double pack_time,
+	double downlink_latency, double uplink_latency)
+{
+	if(slave_idx < 0 || slave_idx >= MAX_SLAVE)
+		return;
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	SlaveSamples& s = slaves[slave_idx];
+	s.response_duration.push_back(response_duration);
+	s.rendering_latency.push_back(rendering_latency);
+	s.network_latency.push_back(network_latency);
+	s.queue_time.push_back(queue_time);
+	s.pack_time.push_back(pack_time);
+	if(downlink_latency >= 0 && uplink_latency >= 0) {
+		s.downlink_latency.push_back(downlink_latency);
+		s.uplink_latency.push_back(uplink_latency);
+	}
+}
+
+int BenchReport::get_frames_count() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return frame_times.size();
+}
+
+bool BenchReport::write_json(const std::string& path, const std::string& label, int slaves_count) const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	FILE* file = path.empty() ? stdout : fopen(path.c_str(), "w");
+	if(!file)
+		return false;
+
+	double wall_time = last_frame_time - start_time;
+
+	fprintf(file, "{\n");
+	fprintf(file, "  \"label\": ");
+	write_string(file, label);
+	fprintf(file, ",\n");
+	fprintf(file, "  \"slaves\": %d,\n", slaves_count);
+	fprintf(file, "  \"frames\": %d,\n", (int)frame_times.size());
+	fprintf(file, "  \"wall_time_s\": %.3f,\n", wall_time);
+	fprintf(file, "  \"fps\": %.3f,\n", wall_time > 0 ? frame_times.size() / wall_time : 0.0);
+	fprintf(file, "  ");
+	write_stats(file, "frame_time_ms", frame_times);
+	fprintf(file, ",\n  \"per_slave\": [");
+
+	bool first = true;
+	for(int i=0;i<MAX_SLAVE;i++)
+	{
+		const SlaveSamples& s = slaves[i];
+		if(s.response_duration.empty())
+			continue;
+
+		double busy = 0;
+		for(double t : s.rendering_latency) {
+			busy += t;
+		}
+
+		fprintf(file, "%s\n    {\"idx\": %d, \"jobs\": %d, \"utilization\": %.4f, ",
+			first ? "" : ",", i, (int)s.response_duration.size(),
+			wall_time > 0 ? busy / wall_time : 0.0);
+		write_stats(file, "response_ms", s.response_duration);
+		fprintf(file, ", ");
+		write_stats(file, "rendering_ms", s.rendering_latency);
+		fprintf(file, ", ");
+		write_stats(file, "network_ms", s.network_latency);
+		fprintf(file, ", ");
+		write_stats(file, "queue_ms", s.queue_time);
+		fprintf(file, ", ");
+		write_stats(file, "pack_ms", s.pack_time);
+		fprintf(file, ", ");
+		write_stats(file, "downlink_ms", s.downlink_latency);
+		fprintf(file, ", ");
+		write_stats(file, "uplink_ms", s.uplink_latency);
+		fprintf(file, "}");
+		first = false;
+	}
+
+	fprintf(file, "\n  ]\n}\n");
+
+	if(file != stdout)
+		fclose(file);
+	return true;
+}
+
+void ScalingReport::start_run(int threads)
+{
+	Run run;
+	run.threads = threads;
+	run.primary_rays = 0;
+	run.shadow_rays = 0;
+	runs.push_back(run);
+}
+
+void ScalingReport::add_frame(double duration, const RayStats& rays)
+{
+	if(runs.empty())
+		return;
+
+	Run& run = runs.back();
+	run.frame_times.push_back(duration);
+	run.primary_rays += rays.primary_rays;
+	run.shadow_rays += rays.shadow_rays;
+}
+
+bool ScalingReport::write_json(const std::string& path, const std::string& label,
+	const std::string& backend, bool shadow_counted) const
+{
+	FILE* file = path.empty() ? stdout : fopen(path.c_str(), "w");
+	if(!file)
+		return false;
+
+	fprintf(file, "{\n");
+	fprintf(file, "  \"label\": ");
+	write_string(file, label);
+	fprintf(file, ",\n  \"backend\": ");
+	write_string(file, backend);
+	fprintf(file, ",\n");
+	fprintf(file, "  \"frames\": %d,\n", runs.empty() ? 0 : (int)runs[0].frame_times.size());
+	fprintf(file, "  \"shadow_rays_counted\": %s,\n", shadow_counted ? "true" : "false");
+	fprintf(file, "  \"runs\": [");
+
+	double base_time = 0;
+	for(size_t i=0;i<runs.size();i++)
+	{
+		const Run& run = runs[i];
+
+		double render_time = 0;
+		for(double t : run.frame_times) {
+			render_time += t;
+		}
+		if(i == 0)
+			base_time = render_time;
+
+		unsigned long long rays = run.primary_rays + (shadow_counted ? run.shadow_rays : 0);
+		double speedup = render_time > 0 ? base_time / render_time : 0.0;
+
+		fprintf(file, "%s\n    {\"threads\": %d, \"render_time_s\": %.3f, \"fps\": %.3f, ",
+			i == 0 ? "" : ",", run.threads, render_time,
+			render_time > 0 ? run.frame_times.size() / render_time : 0.0);
+		fprintf(file, "\"primary_rays\": %llu, \"shadow_rays\": %llu, \"mrays_per_s\": %.3f, ",
+			run.primary_rays, run.shadow_rays,
+			render_time > 0 ? rays / render_time / 1e6 : 0.0);
+		fprintf(file, "\"speedup\": %.3f, \"efficiency\": %.3f, ",
+			speedup, speedup * runs[0].threads / std::max(1, run.threads));
+		write_stats(file, "frame_time_ms", run.frame_times);
+		fprintf(file, "}");
+	}
+
+	fprintf(file, "\n  ]\n}\n");
+
+	if(file != stdout)
+		fclose(file);
+	return true;
+}
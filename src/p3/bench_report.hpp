@@ -0,0 +1,91 @@
+#pragma once
+
+#include "constants.hpp"
+#include "cudaScene.hpp"
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Collects the master's frame times and the slaves' response
+// times during a benchmark run, and writes them out as JSON.
+// Responses are added from the receive threads, frames
+// from the update thread.
+class BenchReport
+{
+public:
+
+	BenchReport();
+
+	// starts the clock, frames completed before are not counted
+	void start();
+
+	void add_frame();
+
+	// a slave's reply, times in seconds (see SlaveInfo). The one-way 
+	// latencies are left out when negative, before the clock offset is known
+	void add_response(int slave_idx, double response_duration,
+		double rendering_latency, double network_latency,
+		double queue_time, double pack_time,
+		double downlink_latency, double uplink_latency);
+
+	int get_frames_count() const;
+
+	// writes the report, 'label' and 'slaves' are copied into it as they are.
+	// Returns false if the file can't be written
+	bool write_json(const std::string& path, const std::string& label, int slaves) const;
+
+private:
+
+	struct SlaveSamples
+	{
+		std::vector<double> response_duration;
+		std::vector<double> rendering_latency;
+		std::vector<double> network_latency;
+		std::vector<double> queue_time;
+		std::vector<double> pack_time;
+		std::vector<double> downlink_latency;
+		std::vector<double> uplink_latency;
+	};
+
+	double start_time;
+	double last_frame_time;
+	std::vector<double> frame_times;
+	SlaveSamples slaves[MAX_SLAVE];
+
+	mutable std::mutex mutex;
+};
+
+// The frame times of an offline benchmark, which renders the same 
+// frames once per thread count, and the rays cast in them. Written
+// out as JSON with the speedup of each thread count over the first.
+// Only used from the thread rendering
+class ScalingReport
+{
+public:
+
+	// the following frames are rendered with this many threads
+	void start_run(int threads);
+
+	// a frame of the run, in seconds
+	void add_frame(double duration, const RayStats& rays);
+
+	// 'label' and 'backend' are copied into it as they are.
+	// shadow_counted is false when the backend can't tell how many
+	// shadow rays it cast, they are left out of rays/s.
+	// Returns false if the file can't be written
+	bool write_json(const std::string& path, const std::string& label,
+		const std::string& backend, bool shadow_counted) const;
+
+private:
+
+	struct Run
+	{
+		int threads;
+		std::vector<double> frame_times;
+		unsigned long long primary_rays;
+		unsigned long long shadow_rays;
+	};
+
+	std::vector<Run> runs;
+};
@@ -21,6 +21,19 @@ struct CudaScene
 
 	int y0; // render offset
 	int render_height;
+
+	// of the NSAMPLES * NSAMPLES jittered samples of a pixel, render
+	// sample_count of them starting at sample0. Several renderers can
+	// each take a part of the samples of the same pixels
+	int sample0;
+	int sample_count;
+};
+
+// rays a backend cast to render a scene
+struct RayStats
+{
+	unsigned long long primary_rays;
+	unsigned long long shadow_rays;
 };
 
 #endif
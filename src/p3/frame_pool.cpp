@@ -0,0 +1,51 @@
+#include "frame_pool.hpp"
+
+#include <cstring>
+
+FramePool::FramePool(int frame_size, int frame_count)
+	: frame_size(frame_size)
+{
+	frames.reserve(frame_count);
+	free_frames.reserve(frame_count);
+
+	for(int i=0;i<frame_count;i++)
+	{
+		unsigned char* frame = new unsigned char[frame_size];
+		std::memset(frame, 0, frame_size);
+		frames.push_back(frame);
+		free_frames.push_back(frame);
+	}
+}
+
+FramePool::~FramePool()
+{
+	for(auto frame : frames) {
+		delete[] frame;
+	}
+}
+
+unsigned char* FramePool::acquire()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if(free_frames.empty())
+		return nullptr;
+
+	unsigned char* frame = free_frames.back();
+	free_frames.pop_back();
+	return frame;
+}
+
+void FramePool::release(unsigned char* frame)
+{
+	if(!frame)
+		return;
+
+	std::lock_guard<std::mutex> lock(mutex);
+	free_frames.push_back(frame);
+}
+
+int FramePool::get_frame_size() const
+{
+	return frame_size;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <mutex>
+#include <vector>
+
+// A fixed set of preallocated frame buffers.
+// The master assembles the image pieces sent by the slaves directly
+// into one of these buffers and hands the finished frame to the display,
+// so no allocation or copy happens per slice.
+class FramePool
+{
+public:
+
+	FramePool(int frame_size, int frame_count);
+	~FramePool();
+
+	// returns a free frame, or nullptr if every frame is in use
+	unsigned char* acquire();
+
+	// gives a frame back to the pool. nullptr is ignored
+	void release(unsigned char* frame);
+
+	int get_frame_size() const;
+
+private:
+
+	// prevent from copying
+	FramePool(FramePool const& other) = delete;
+	void operator=(FramePool const& other) = delete;
+
+	int frame_size;
+	std::vector<unsigned char*> frames; // every frame owned by the pool
+	std::vector<unsigned char*> free_frames;
+	std::mutex mutex;
+};
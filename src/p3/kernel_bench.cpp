@@ -0,0 +1,250 @@
+// Microbenchmarks of the CPU renderers' hot kernels.
+// Times each kernel of kernel_bench.hpp on its own, in the scalar form
+// of the single renderer and in the vector forms of the simd renderer,
+// over a coherent set of rays (the camera's rays through the pixels of
+// the middle of the frame) and an incoherent one (rays from points
+// scattered over the table, in any direction). Reports the best time
+// of a pass over the rays, in ns per ray and millions of rays per
+// second of one core, to tell which kernel got slower when a frame does.
+//
+// usage: kernel_bench [-k kernel|all] [-t seconds] [-n rays] [-r seed]
+//
+// seconds is how long each kernel is timed for, in each of its forms.
+
+#include "kernel_bench.hpp"
+#include "raytracer_simd.hpp"
+#include "constants.hpp"
+#include "helper_math.h"
+#include "cycleTimer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+static const char* kernel_names[KERNEL_COUNT] = {
+	"spheres", "planes", "shadow", "material", "quaternion", "pack"
+};
+
+// the forms a kernel is timed in, and the vector width of each
+static const char* form_names[] = {"scalar", "sse", "avx2"};
+static const int form_widths[] = {1, 4, 8};
+static const int forms_count = sizeof(form_widths) / sizeof(form_widths[0]);
+
+static void print_usage()
+{
+	std::cerr << "usage: kernel_bench [-k kernel|all] [-t seconds] [-n rays] [-r seed]" << std::endl;
+	std::cerr << "kernels:";
+	for(int i=0;i<KERNEL_COUNT;i++) {
+		std::cerr << " " << kernel_names[i];
+	}
+	std::cerr << std::endl;
+}
+
+static float* alloc_floats(int count)
+{
+	void* p = nullptr;
+	if(posix_memalign(&p, 32, count * sizeof(float)) != 0)
+		return nullptr;
+	std::memset(p, 0, count * sizeof(float));
+	return (float*)p;
+}
+
+static void alloc_rays(KernelRays& rays, int count)
+{
+	rays.count = count;
+	float** arrays[] = {&rays.ox, &rays.oy, &rays.oz, &rays.dx, &rays.dy, &rays.dz,
+		&rays.t, &rays.geom, &rays.color[0], &rays.color[1], &rays.color[2]};
+	for(float** array : arrays) {
+		*array = alloc_floats(count);
+	}
+	rays.pixels = new unsigned char[count * PIXEL_SIZE];
+}
+
+static void set_ray(KernelRays& rays, int i, float3 origin, float3 dir)
+{
+	dir = normalize(dir);
+	rays.ox[i] = origin.x; rays.oy[i] = origin.y; rays.oz[i] = origin.z;
+	rays.dx[i] = dir.x; rays.dy[i] = dir.y; rays.dz[i] = dir.z;
+}
+
+// the balls spread over the table and turned every which way,
+// seen by the window's camera from above the table
+static CudaScene make_scene(std::mt19937& rng)
+{
+	std::uniform_real_distribution<float> unit(-1, 1);
+
+	CudaScene scene;
+	std::memset(&scene, 0, sizeof(scene));
+	for(int i=0;i<SPHERES;i++)
+	{
+		float x = ((i % 4) - 1.5f) * (TABLE_WIDTH - 1) / 2 + unit(rng);
+		float z = ((i / 4) - 1.5f) * (TABLE_HEIGHT - 1) / 2 + unit(rng);
+		scene.ball_position[i] = make_float3(x, 1.0, z);
+		float4 q;
+		q.x = unit(rng); q.y = unit(rng); q.z = unit(rng); q.w = unit(rng);
+		scene.ball_orientation[i] = q / std::sqrt(dot(q, q));
+	}
+
+	// 45 degrees of field of view, looking down from 25 above the table
+	float dist = std::tan(3.1415926f / 8);
+	scene.cam_position = make_float3(0, 25, 0);
+	scene.dir = make_float3(0, -1, 0);
+	scene.cU = make_float3(0, 0, -dist);
+	scene.ARcR = make_float3(dist * WIDTH / HEIGHT, 0, 0);
+	scene.y0 = 0;
+	scene.render_height = HEIGHT;
+	scene.sample0 = 0;
+	scene.sample_count = NSAMPLES * NSAMPLES;
+	return scene;
+}
+
+// the camera's rays through the pixel centers of the middle of the
+// frame, row by row, as the simd renderer casts them
+static void make_coherent_rays(KernelRays& rays, const CudaScene& scene)
+{
+	int width = std::min(WIDTH, 256);
+	for(int i=0;i<rays.count;i++)
+	{
+		int x = (WIDTH - width) / 2 + i % width;
+		int y = (HEIGHT / 2 + i / width) % HEIGHT;
+		float di = (x + 0.5f) / WIDTH * 2 - 1;
+		float dj = (y + 0.5f) / HEIGHT * 2 - 1;
+		set_ray(rays, i, scene.cam_position, scene.dir + dj * scene.cU + di * scene.ARcR);
+	}
+}
+
+// packets of 8 rays from a point of the table or above it, each
+// ray of a packet in a direction of its own
+static void make_incoherent_rays(KernelRays& rays, std::mt19937& rng)
+{
+	std::uniform_real_distribution<float> unit(-1, 1);
+	std::normal_distribution<float> normal(0, 1);
+
+	float3 origin = make_float3(0, 0, 0);
+	for(int i=0;i<rays.count;i++)
+	{
+		if(i % 8 == 0) {
+			origin.x = unit(rng) * TABLE_WIDTH;
+			origin.y = 0.001f + 4 * (unit(rng) + 1);
+			origin.z = unit(rng) * TABLE_HEIGHT;
+		}
+		float3 dir;
+		do {
+			dir.x = normal(rng); dir.y = normal(rng); dir.z = normal(rng);
+		} while(dot(dir, dir) < 1e-6f);
+		set_ray(rays, i, origin, dir);
+	}
+}
+
+// best seconds of a pass of the kernel over the rays, negative
+// if there is no such form of it
+static double time_kernel(BenchKernel kernel, int width, const CudaScene& scene,
+	KernelRays& rays, double seconds)
+{
+	auto run = [&]() {
+		if(width == 1) {
+			singleRunKernel(kernel, scene, rays);
+			return true;
+		}
+		return simdRunKernel(kernel, width, scene, rays);
+	};
+
+	// warms up the caches, and tells if the form exists
+	if(!run())
+		return -1;
+
+	double best = 1e30;
+	double start = CycleTimer::currentSeconds();
+	int passes = 0;
+	do {
+		double pass_start = CycleTimer::currentSeconds();
+		run();
+		best = std::min(best, CycleTimer::currentSeconds() - pass_start);
+		passes++;
+	} while(passes < 3 || CycleTimer::currentSeconds() - start < seconds);
+
+	return best;
+}
+
+int main(int argc, char* argv[])
+{
+	std::string kernel = "all";
+	double seconds = 0.25;
+	int count = 1 << 16;
+	unsigned int seed = 418;
+
+	for(int i=1;i<argc;i++)
+	{
+		if(i + 1 < argc && !std::strcmp(argv[i], "-k")) {
+			kernel = argv[++i];
+		}else if(i + 1 < argc && !std::strcmp(argv[i], "-t")) {
+			seconds = std::atof(argv[++i]);
+		}else if(i + 1 < argc && !std::strcmp(argv[i], "-n")) {
+			count = std::atoi(argv[++i]);
+		}else if(i + 1 < argc && !std::strcmp(argv[i], "-r")) {
+			seed = std::strtoul(argv[++i], nullptr, 10);
+		}else{
+			print_usage();
+			return 1;
+		}
+	}
+
+	std::vector<int> to_run;
+	for(int i=0;i<KERNEL_COUNT;i++) {
+		if(kernel == "all" || kernel == kernel_names[i])
+			to_run.push_back(i);
+	}
+	// whole packets of the widest form
+	count = (std::max(count, 8) + 7) / 8 * 8;
+	if(to_run.empty() || seconds <= 0) {
+		print_usage();
+		return 1;
+	}
+
+	initialize_constants();
+	simdInitialize();
+
+	std::mt19937 rng(seed);
+	CudaScene scene = make_scene(rng);
+
+	KernelRays ray_sets[2];
+	const char* ray_set_names[2] = {"coherent", "incoherent"};
+	alloc_rays(ray_sets[0], count);
+	alloc_rays(ray_sets[1], count);
+	make_coherent_rays(ray_sets[0], scene);
+	make_incoherent_rays(ray_sets[1], rng);
+
+	printf("%d rays per set, %d spheres, %d planes\n", count, SPHERES, PLANES);
+	printf("%-12s%-12s%-8s%12s%12s%10s\n", "kernel", "rays", "form", "ns/ray", "Mrays/s", "speedup");
+
+	for(int k : to_run)
+	{
+		for(int set=0;set<2;set++)
+		{
+			double scalar = -1;
+			for(int f=0;f<forms_count;f++)
+			{
+				double best = time_kernel((BenchKernel)k, form_widths[f], scene, ray_sets[set], seconds);
+				if(best < 0) {
+					printf("%-12s%-12s%-8s%12s%12s%10s\n", kernel_names[k], ray_set_names[set],
+						form_names[f], "-", "-", "-");
+					continue;
+				}
+
+				double ns = best * 1e9 / count;
+				if(f == 0)
+					scalar = ns;
+				printf("%-12s%-12s%-8s%12.2f%12.2f%10.2f\n", kernel_names[k], ray_set_names[set],
+					form_names[f], ns, 1e3 / ns, scalar > 0 ? scalar / ns : 0.0);
+			}
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "cudaScene.hpp"
+
+// The hot kernels of the CPU renderers, which kernel_bench times
+// one at a time over sets of rays
+enum BenchKernel
+{
+	// nearest sphere and distance to it
+	KERNEL_SPHERES,
+	// nearest plane of the table and distance to it
+	KERNEL_PLANES,
+	// light reaching a point through the spheres
+	KERNEL_SHADOW,
+	// color of a point on a ball
+	KERNEL_MATERIAL,
+	// rotation of a point into a ball's frame
+	KERNEL_QUATERNION,
+	// gamma correction and 8 bit packing of colors
+	KERNEL_PACK,
+	KERNEL_COUNT
+};
+
+// A set of rays, as a structure of arrays aligned to 32 bytes so that
+// any vector width can load it. count is a multiple of 8, and the rays
+// of a packet of 8 start at the same point as the simd renderer's do.
+// The material and quaternion kernels take a ray's direction as a
+// point on the unit ball, and the pack kernel takes its square as a color
+struct KernelRays
+{
+	int count;
+	float* ox;
+	float* oy;
+	float* oz;
+	float* dx;
+	float* dy;
+	float* dz;
+
+	// what the kernels found, so that they can't be optimized out
+	float* t;
+	float* geom;
+	float* color[3];
+	// count * PIXEL_SIZE
+	unsigned char* pixels;
+};
+
+// runs a kernel of the single renderer over the rays
+void singleRunKernel(BenchKernel kernel, const CudaScene& scene, KernelRays& rays);
+
+// runs the simd renderer's form of a kernel, of a vector width of 4 (SSE)
+// or 8 (AVX2). False if there is no such form of the kernel, or the cpu
+// can't run it
+bool simdRunKernel(BenchKernel kernel, int width, const CudaScene& scene, KernelRays& rays);
@@ -0,0 +1,395 @@
+// Offline load balancer simulator.
+// Replays a cluster of simulated slaves through the LoadBalancer strategies,
+// the same way the master's assign_work does: the frame is cut at equal
+// shares of the cost the RowCostModel predicts, and the slaves' rendering
+// factors are seconds per unit of cost. Reports the frame time
+// mean/p95/p99 and how much of the time the slaves sat idle.
+//
+// usage: lb_sim [-f frames] [-s strategy|all] [-p profiles] [-r seed]
+//
+// A profiles file has one slave per line:
+//   name seconds_per_row latency bytes_per_second jitter join_frame leave_frame
+// seconds_per_row is for a row of average cost, jitter is the standard
+// deviation of the log of the time multipliers, leave_frame -1 never leaves.
+// Lines starting with '#' are ignored.
+
+#include "load_balancer.hpp"
+#include "row_cost_model.hpp"
+#include "slave_info.hpp"
+#include "constants.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+struct SlaveProfile
+{
+	std::string name;
+	double seconds_per_row;
+	double latency;
+	double bytes_per_second;
+	double jitter;
+	int join_frame;
+	int leave_frame;
+};
+
+struct SimResult
+{
+	double mean;
+	double p95;
+	double p99;
+	double idle_fraction;
+};
+
+static const char* strategies[] = {
+	"equal", "naive", "naive_mean", "static_naive_mean", "ab", "adaptive"
+};
+static const int strategies_count = sizeof(strategies) / sizeof(strategies[0]);
+
+// a mixed cluster: fast and slow renderers,
+// one behind a slow link and one that comes and goes
+static std::vector<SlaveProfile> default_profiles()
+{
+	std::vector<SlaveProfile> profiles;
+	profiles.push_back({"fast", 0.0001, 0.002, 100e6, 0.05, 0, -1});
+	profiles.push_back({"medium", 0.0002, 0.003, 100e6, 0.1, 0, -1});
+	profiles.push_back({"slow_link", 0.0001, 0.010, 20e6, 0.1, 0, -1});
+	profiles.push_back({"flaky", 0.00015, 0.003, 100e6, 0.4, 100, 400});
+	return profiles;
+}
+
+static bool load_profiles(const char* path, std::vector<SlaveProfile>& profiles)
+{
+	std::ifstream file(path);
+	if(!file)
+		return false;
+
+	std::string line;
+	while(std::getline(file, line))
+	{
+		if(line.empty() || line[0] == '#')
+			continue;
+
+		std::istringstream in(line);
+		SlaveProfile p;
+		if(!(in >> p.name >> p.seconds_per_row >> p.latency >> p.bytes_per_second
+			>> p.jitter >> p.join_frame >> p.leave_frame)) {
+			std::cerr << "bad profile line: " << line << std::endl;
+			return false;
+		}
+		profiles.push_back(p);
+	}
+
+	return !profiles.empty() && (int)profiles.size() <= MAX_SLAVE;
+}
+
+// where the balls are: the fraction of each row they cover, which the
+// master gets from the scene, and the real cost of each row relative
+// to an average row. A few balls move up and down the screen. The
+// rows also cost more towards the bottom of the screen, which the
+// master's model only learns from the strips' rendering times
+static void fill_rows(int frame, double* coverage, double* row_cost)
+{
+	static const int balls = 3;
+	static const double ball_rows = 30;
+	static const double ball_width = 0.1;
+	static const double ball_cost = 1.5;
+	static const double bottom_cost = 0.6;
+
+	double sum = 0;
+	for(int y=0;y<HEIGHT;y++)
+	{
+		coverage[y] = 0;
+		for(int k=0;k<balls;k++)
+		{
+			double center = HEIGHT * (0.5 + 0.4 * std::sin(frame * 0.01 * (k + 1) + k));
+			double d = (y - center) / ball_rows;
+			if(d * d < 1)
+				coverage[y] += ball_width * std::sqrt(1 - d * d);
+		}
+		coverage[y] = std::min(1.0, coverage[y]);
+
+		double base = 1 + bottom_cost * y / HEIGHT;
+		row_cost[y] = base * (1 + ball_cost * coverage[y]);
+		sum += row_cost[y];
+	}
+
+	for(int y=0;y<HEIGHT;y++) {
+		row_cost[y] *= HEIGHT / sum;
+	}
+}
+
+static void calc_weights(const std::string& strategy, SlaveInfo* input, double* output, int size,
+	double total_cost)
+{
+	if(strategy == "naive")
+		LoadBalancer::calc_naive(input, output, size);
+	else if(strategy == "naive_mean")
+		LoadBalancer::calc_naive_mean(input, output, size);
+	else if(strategy == "static_naive_mean")
+		LoadBalancer::calc_static_naive_mean(input, output, size);
+	else if(strategy == "ab")
+		LoadBalancer::calc_ab(input, output, size, total_cost);
+	else if(strategy == "adaptive")
+		LoadBalancer::calc_adaptive(input, output, size, total_cost);
+	else
+		LoadBalancer::calc_equal(input, output, size);
+}
+
+static double percentile(const std::vector<double>& sorted, double p)
+{
+	int rank = (int)std::ceil(p * sorted.size()) - 1;
+	rank = std::max(0, std::min((int)sorted.size() - 1, rank));
+	return sorted[rank];
+}
+
+static bool is_active(const SlaveProfile& p, int frame)
+{
+	return frame >= p.join_frame && (p.leave_frame < 0 || frame < p.leave_frame);
+}
+
+static SimResult simulate(const std::string& strategy, const std::vector<SlaveProfile>& profiles,
+	int frames, unsigned int seed)
+{
+	std::mt19937 rng(seed);
+	std::normal_distribution<double> unit_noise(0, 1);
+	int n = profiles.size();
+
+	SlaveInfo slaves_info[MAX_SLAVE];
+	SlaveInfo active_info[MAX_SLAVE];
+	int active_idx[MAX_SLAVE];
+	double weight[MAX_SLAVE];
+	double coverage[HEIGHT];
+	double row_cost[HEIGHT];
+	std::memset(slaves_info, 0, sizeof(slaves_info));
+
+	// a run of the master starts from scratch
+	LoadBalancer::reset();
+	RowCostModel cost_model;
+
+	std::vector<double> frame_times;
+	double busy_time = 0;
+	double available_time = 0;
+
+	for(int frame=0;frame<frames;frame++)
+	{
+		fill_rows(frame, coverage, row_cost);
+
+		// the jitter of every slave's rendering and network, drawn
+		// whether it renders this frame or not, so every strategy
+		// sees the same jitter
+		double render_noise[MAX_SLAVE];
+		double network_noise[MAX_SLAVE];
+		for(int i=0;i<n;i++)
+		{
+			double jitter = profiles[i].jitter;
+			render_noise[i] = std::exp(jitter * unit_noise(rng) - 0.5 * jitter * jitter);
+			network_noise[i] = std::exp(jitter * unit_noise(rng) - 0.5 * jitter * jitter);
+		}
+
+		// slaves that are connected this frame, a slave
+		// that joins starts without history like on the master
+		int active = 0;
+		bool has_history = true;
+		for(int i=0;i<n;i++)
+		{
+			const SlaveProfile& p = profiles[i];
+			if(frame == p.join_frame) {
+				std::memset(&slaves_info[i], 0, sizeof(SlaveInfo));
+				slaves_info[i].idx = i;
+				// the master pings it, the round trip is its fixed latency
+				slaves_info[i].probes = 1;
+				slaves_info[i].probe_rtt = p.latency;
+			}
+			if(!is_active(p, frame))
+				continue;
+
+			if(!slaves_info[i].has_estimates())
+				has_history = false;
+			active_info[active] = slaves_info[i];
+			active_idx[active] = i;
+			active++;
+		}
+
+		if(active == 0)
+			continue;
+
+		// the master's assign_work: weights are shares of the predicted
+		// cost of the frame, which is cut where the cost reaches them
+		cost_model.predict(coverage);
+		double total_cost = cost_model.get_total_cost();
+		if(has_history) {
+			calc_weights(strategy, active_info, weight, active, total_cost);
+		}else{
+			LoadBalancer::calc_equal(active_info, weight, active);
+		}
+
+		double sum_weight = 0;
+		int last_available = -1;
+		for(int i=0;i<active;i++) {
+			sum_weight += weight[i];
+			if(weight[i] > 0)
+				last_available = i;
+		}
+		if(last_available < 0)
+			last_available = active - 1;
+
+		int heights[MAX_SLAVE];
+		int sum_height = 0;
+		double sum_share = 0;
+		for(int i=0;i<active;i++)
+		{
+			if(i == last_available || weight[i] <= 0) {
+				heights[i] = 0;
+				continue;
+			}
+			sum_share += weight[i] / sum_weight;
+			int end_row = cost_model.find_row(sum_share * total_cost);
+			end_row = std::min(HEIGHT, std::max(sum_height, end_row));
+			heights[i] = end_row - sum_height;
+			sum_height = end_row;
+		}
+		heights[last_available] = HEIGHT - sum_height;
+
+		double response[MAX_SLAVE];
+		double frame_time = 0;
+		int y0 = 0;
+		for(int a=0;a<active;a++)
+		{
+			int i = active_idx[a];
+			const SlaveProfile& p = profiles[i];
+			int height = heights[a];
+			response[a] = 0;
+			if(height > 0)
+			{
+				double cost = 0;
+				for(int y=y0;y<y0 + height;y++) {
+					cost += row_cost[y];
+				}
+				double job_cost = cost_model.get_cost(y0, height);
+
+				double rendering_latency = p.seconds_per_row * cost * render_noise[i];
+				double network_latency = p.latency * network_noise[i]
+					+ height * WIDTH * PIXEL_SIZE / p.bytes_per_second;
+				response[a] = rendering_latency + network_latency;
+
+				// the master's bookkeeping of a reply (see record_response)
+				SlaveInfo& si = slaves_info[i];
+				si.messages_received++;
+				si.job_y0 = y0;
+				si.job_height = height;
+				si.job_cost = job_cost;
+				si.response_duration = response[a];
+				si.sum_response_duration += si.response_duration;
+				si.rendering_latency = rendering_latency;
+				si.network_latency = network_latency;
+				si.sum_network_latency += si.network_latency;
+				si.rendering_factor = job_cost > 0 ? rendering_latency / job_cost : 0;
+				si.sum_rendering_factor += si.rendering_factor;
+				if(si.messages_received > 1) {
+					cost_model.add_measurement(y0, height, rendering_latency,
+						si.est_rendering_factor * job_cost);
+				}
+				LoadBalancer::update_estimates(si);
+			}
+
+			frame_time = std::max(frame_time, response[a]);
+			y0 += height;
+		}
+
+		for(int i=0;i<active;i++) {
+			busy_time += response[i];
+		}
+		available_time += frame_time * active;
+		frame_times.push_back(frame_time);
+	}
+
+	SimResult result = {0, 0, 0, 0};
+	if(frame_times.empty())
+		return result;
+
+	for(double t : frame_times) {
+		result.mean += t;
+	}
+	result.mean /= frame_times.size();
+
+	std::sort(frame_times.begin(), frame_times.end());
+	result.p95 = percentile(frame_times, 0.95);
+	result.p99 = percentile(frame_times, 0.99);
+	result.idle_fraction = available_time > 0 ? 1 - busy_time / available_time : 0;
+	return result;
+}
+
+static void print_usage()
+{
+	std::cerr << "usage: lb_sim [-f frames] [-s strategy|all] [-p profiles] [-r seed]" << std::endl;
+	std::cerr << "strategies:";
+	for(int i=0;i<strategies_count;i++) {
+		std::cerr << " " << strategies[i];
+	}
+	std::cerr << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+	int frames = 600;
+	std::string strategy = "all";
+	const char* profiles_path = nullptr;
+	unsigned int seed = 418;
+
+	for(int i=1;i<argc;i++)
+	{
+		if(i + 1 < argc && !std::strcmp(argv[i], "-f")) {
+			frames = std::atoi(argv[++i]);
+		}else if(i + 1 < argc && !std::strcmp(argv[i], "-s")) {
+			strategy = argv[++i];
+		}else if(i + 1 < argc && !std::strcmp(argv[i], "-p")) {
+			profiles_path = argv[++i];
+		}else if(i + 1 < argc && !std::strcmp(argv[i], "-r")) {
+			seed = std::strtoul(argv[++i], nullptr, 10);
+		}else{
+			print_usage();
+			return 1;
+		}
+	}
+
+	std::vector<SlaveProfile> profiles;
+	if(profiles_path) {
+		if(!load_profiles(profiles_path, profiles)) {
+			std::cerr << "can't load profiles from " << profiles_path << std::endl;
+			return 1;
+		}
+	}else{
+		profiles = default_profiles();
+	}
+
+	std::vector<std::string> to_run;
+	for(int i=0;i<strategies_count;i++) {
+		if(strategy == "all" || strategy == strategies[i])
+			to_run.push_back(strategies[i]);
+	}
+	if(to_run.empty()) {
+		print_usage();
+		return 1;
+	}
+
+	printf("%d slaves, %d frames\n", (int)profiles.size(), frames);
+	printf("%-18s %10s %10s %10s %8s\n", "strategy", "mean(ms)", "p95(ms)", "p99(ms)", "idle");
+	for(const std::string& s : to_run)
+	{
+		// every strategy sees the same jitter
+		SimResult r = simulate(s, profiles, frames, seed);
+		printf("%-18s %10.2f %10.2f %10.2f %7.1f%%\n", s.c_str(),
+			r.mean * 1000, r.p95 * 1000, r.p99 * 1000, r.idle_fraction * 100);
+	}
+
+	return 0;
+}
@@ -1,36 +1,44 @@
 #include "load_balancer.hpp"
 #include "slave_info.hpp"
-#include "raytracer_application.hpp"
 #include "constants.hpp"
 
 #include <iostream>
 #include <algorithm>
+#include <cmath>
 
-// if the frame count has not reached this number yet
-// we always divide equally
-static const int WARM_FRAMES = 60;
+// weight of the newest sample in the estimates
+static const double EWMA_ALPHA = 0.25;
 
-void LoadBalancer::calc(const RaytracerApplication* app, SlaveInfo* input, double* output, int size) 
-{
-	static bool warmed_up = false;
+// how many standard deviations above its estimate
+// a slave's rendering factor is planned for
+static const double CONFIDENCE_Z = 1.0;
 
-	// always divide it equally at first
-	if(app->cur_render_frame_number <= WARM_FRAMES) {
-		calc_equal(input, output, size);
-	}else{
+// the transfer time per byte is fitted from how the latency varies
+// with the reply size once the sizes of a slave vary by more than a
+// few rows, and else from their means
+static const double MIN_REPLY_BYTES_STDDEV = 4.0 * WIDTH * PIXEL_SIZE;
 
-		if(!warmed_up) {
-			warmed_up = true;
-			std::cout<<"starting dynamic load balancing ... "<<std::endl;
-		}
+static const double BYTES_PER_ROW = WIDTH * PIXEL_SIZE;
 
-		// pick one of the techniques	
-		// calc_equal(input, output, size);
-		// calc_naive(input, output, size);
-		calc_ab(input, output, size, HEIGHT);
-		// calc_naive_mean(input, output, size);
-		// calc_static_naive_mean(input, output, size);
-	}	
+// fixed part of the slave's network latency, 
+// what is left without the transfer of the pixels
+static double get_network_intercept(const SlaveInfo& si)
+{
+	return std::max(0.0, si.est_network_latency - si.est_seconds_per_byte * si.est_reply_bytes);
+}
+
+void LoadBalancer::calc(SlaveInfo* input, double* output, int size, double total_workload) 
+{
+	// the estimates are usable from the first response on,
+	// there is no need to wait for long averages to settle
+
+	// pick one of the techniques	
+	// calc_equal(input, output, size);
+	// calc_naive(input, output, size);
+	// calc_ab(input, output, size, total_workload);
+	// calc_naive_mean(input, output, size);
+	// calc_static_naive_mean(input, output, size);
+	calc_adaptive(input, output, size, total_workload);
 
 	// std::cout<<"weight : ";
 	// for(int i=0;i<size;i++) 
@@ -90,10 +98,14 @@ void LoadBalancer::calc_naive_mean(SlaveInfo* input, double* output, int size)
 	}	
 }
 
+// frames calc_static_naive_mean has set its weights from, and the weights
+static int static_naive_frames = 0;
+static double static_naive_weight[MAX_SLAVE];
+
 void LoadBalancer::calc_static_naive_mean(SlaveInfo* input, double* output, int size)
 {
-	static int init = 0;
-	static double weight[MAX_SLAVE];
+	int& init = static_naive_frames;
+	double* weight = static_naive_weight;
 
 	if(init < 10) {
 		//calculate sum of the inverse
@@ -116,6 +128,12 @@ void LoadBalancer::calc_static_naive_mean(SlaveInfo* input, double* output, int
 	}
 }
 
+void LoadBalancer::reset()
+{
+	static_naive_frames = 0;
+	std::fill(static_naive_weight, static_naive_weight + MAX_SLAVE, 0.0);
+}
+
 void LoadBalancer::calc_equal(SlaveInfo* input, double* output, int size)
 {
 	double w = 1.0 / size;
@@ -125,79 +143,196 @@ void LoadBalancer::calc_equal(SlaveInfo* input, double* output, int size)
 	}
 }
 
-// sort using a custom function object
-struct {
-    bool operator()(const SlaveInfo& a, const SlaveInfo& b)
-    {   
-        return a.get_avg_network_latency() < b.get_avg_network_latency();
-    }   
-} compare_slave;
-
 void LoadBalancer::calc_ab(SlaveInfo* input, double* output, int size, double total_workload)
+{
+	static double latency[MAX_SLAVE];
+	static double factor[MAX_SLAVE];
+
+	for(int i=0;i<size;i++) {
+		latency[i] = input[i].get_avg_network_latency();
+		factor[i] = input[i].get_avg_rendering_factor();
+	}
+
+	calc_min_max(latency, factor, output, size, total_workload);
+}
+
+void LoadBalancer::calc_adaptive(SlaveInfo* input, double* output, int size, double total_workload)
+{
+	static double latency[MAX_SLAVE];
+	static double factor[MAX_SLAVE];
+	static double slave_output[MAX_SLAVE];
+	static int slave_idx[MAX_SLAVE];
+
+	int n = 0;
+	for(int i=0;i<size;i++) 
+	{
+		output[i] = 0;
+		if(!input[i].has_estimates())
+			continue;
+
+		// the workload is in units of predicted cost, the 
+		// transfer time goes with the rows. Take the frame's
+		// average rows per unit of cost to put it in the same units
+		double transfer_factor = input[i].est_seconds_per_byte * BYTES_PER_ROW * HEIGHT / total_workload;
+
+		latency[n] = get_network_intercept(input[i]);
+		factor[n] = std::max(1e-9, input[i].est_rendering_factor 
+			+ CONFIDENCE_Z * std::sqrt(input[i].est_rendering_factor_var)
+			+ transfer_factor);
+		slave_idx[n] = i;
+		n++;
+	}
+
+	if(n == 0) {
+		calc_equal(input, output, size);
+		return;
+	}
+
+	calc_min_max(latency, factor, slave_output, n, total_workload);
+
+	for(int i=0;i<n;i++) {
+		output[slave_idx[i]] = slave_output[i];
+	}
+}
+
+void LoadBalancer::update_estimates(SlaveInfo& si)
+{
+	double reply_bytes = si.job_height * BYTES_PER_ROW;
+
+	// the first sample is the estimate, unless the
+	// estimates come from a previous run
+	if(si.messages_received <= 1 && !si.est_from_history) {
+		si.est_rendering_factor = si.rendering_factor;
+		si.est_rendering_factor_var = 0;
+		si.est_network_latency = si.network_latency;
+		si.est_network_latency_var = 0;
+		si.est_reply_bytes = reply_bytes;
+		si.est_reply_bytes_var = 0;
+		si.est_reply_bytes_latency_cov = 0;
+		si.est_seconds_per_byte = 0;
+		return;
+	}
+
+	double diff = si.rendering_factor - si.est_rendering_factor;
+	si.est_rendering_factor += EWMA_ALPHA * diff;
+	si.est_rendering_factor_var = (1 - EWMA_ALPHA) * (si.est_rendering_factor_var + EWMA_ALPHA * diff * diff);
+
+	double diff_latency = si.network_latency - si.est_network_latency;
+	si.est_network_latency += EWMA_ALPHA * diff_latency;
+	si.est_network_latency_var = (1 - EWMA_ALPHA) * (si.est_network_latency_var + EWMA_ALPHA * diff_latency * diff_latency);
+
+	// fit network_latency = intercept + seconds_per_byte * reply_bytes
+	double diff_bytes = reply_bytes - si.est_reply_bytes;
+	si.est_reply_bytes += EWMA_ALPHA * diff_bytes;
+	si.est_reply_bytes_var = (1 - EWMA_ALPHA) * (si.est_reply_bytes_var + EWMA_ALPHA * diff_bytes * diff_bytes);
+	si.est_reply_bytes_latency_cov = (1 - EWMA_ALPHA) * (si.est_reply_bytes_latency_cov + EWMA_ALPHA * diff_bytes * diff_latency);
+
+	if(si.est_reply_bytes_var > MIN_REPLY_BYTES_STDDEV * MIN_REPLY_BYTES_STDDEV) {
+		si.est_seconds_per_byte = std::max(0.0, si.est_reply_bytes_latency_cov / si.est_reply_bytes_var);
+	} else if(si.est_reply_bytes > 0) {
+		// the strips settled on about the same size. The ping's round
+		// trip is the latency of a reply without pixels, the rest of
+		// the latency is the transfer of the reply. Without pings yet,
+		// all of it is, which is an upper bound
+		double fixed_latency = si.probes > 0 ? si.probe_rtt : 0;
+		si.est_seconds_per_byte = std::max(0.0, si.est_network_latency - fixed_latency) / si.est_reply_bytes;
+	}
+}
+
+void LoadBalancer::update_clock_offset(SlaveInfo& si, double master_send, 
+	double slave_receive, double slave_send, double master_receive)
+{
+	// the time spent on the wire, and the offset assuming
+	// both ways take as long (as NTP does)
+	double rtt = (master_receive - master_send) - (slave_send - slave_receive);
+	double offset = ((slave_receive - master_send) + (slave_send - master_receive)) / 2;
+
+	int k = si.probes % CLOCK_PROBES;
+	si.probe_offsets[k] = offset;
+	si.probe_rtts[k] = std::max(0.0, rtt);
+	si.probes++;
+
+	// the probe that waited the least had the least 
+	// room for the two ways to differ
+	int best = 0;
+	int n = std::min(si.probes, CLOCK_PROBES);
+	for(int i=1;i<n;i++) {
+		if(si.probe_rtts[i] < si.probe_rtts[best])
+			best = i;
+	}
+	si.clock_offset = si.probe_offsets[best];
+	si.probe_rtt = si.probe_rtts[best];
+}
+
+double LoadBalancer::predict_response_duration(const SlaveInfo& si, double cost, int rows)
+{
+	return get_network_intercept(si) 
+		+ si.est_seconds_per_byte * rows * BYTES_PER_ROW
+		+ si.est_rendering_factor * cost;
+}
+
+void LoadBalancer::calc_min_max(const double* latency, const double* factor, double* output, int size, double total_workload)
 {
 	double cur_workload = 0;
 	double sum_inv_b = 0;
-	int last_slave_idx = 0;;
+	int last_slave_idx = 0;
+	bool reached = false;
 	double balanced_resp_time = 0;
 
-	static SlaveInfo copy[MAX_SLAVE];
+	// the workload is met once within this much of it,
+	// rounding errors don't pick the wrong segment
+	double tolerance = 1e-9 * std::max(1.0, total_workload);
+
+	// sort based on network latency
+	static int order[MAX_SLAVE];
 	for(int i=0;i<size;i++) {
-		copy[i].idx = input[i].idx;
-		copy[i].messages_received = input[i].messages_received;
-		copy[i].sum_network_latency = input[i].sum_network_latency;
-		copy[i].sum_rendering_factor = input[i].sum_rendering_factor;
+		order[i] = i;
 	}
-
-	// sort copy based on average network latency
-	std::sort(copy, copy + size, compare_slave);
+	std::sort(order, order + size, [latency](int a, int b) {
+		return latency[a] < latency[b];
+	});
 
 	for(int i=1;i<size;i++)
 	{
-		double diff_a =  copy[i].get_avg_network_latency() - copy[i-1].get_avg_network_latency();
-		sum_inv_b += (1 / copy[i-1].get_avg_rendering_factor());
+		double diff_a = latency[order[i]] - latency[order[i-1]];
+		sum_inv_b += (1 / factor[order[i-1]]);
 		
 		cur_workload += diff_a * sum_inv_b;
 		
 		// std::cout<<"cur workload "<<cur_workload<<std::endl;
 
-		if(cur_workload >= total_workload){
+		if(cur_workload >= total_workload - tolerance){
 			last_slave_idx = i;
+			reached = true;
 			break;
 		}
 	}
 
-	if(cur_workload > total_workload) {
-		// std::cout<<"aaa"<<std::endl;
-
-		double diff_workload = cur_workload - total_workload;
+	if(reached) {
+		// the slaves before last_slave_idx are done with the workload
+		// before it starts, back off to where they meet it
+		double diff_workload = std::max(0.0, cur_workload - total_workload);
 		double diff_response_time = diff_workload / sum_inv_b;
-		balanced_resp_time = copy[last_slave_idx].get_avg_network_latency() 
-								- diff_response_time; 
-	}else if(cur_workload < total_workload) {
-		// std::cout<<"bbb"<<std::endl;
-
-		double diff_workload = total_workload - cur_workload;
+		balanced_resp_time = latency[order[last_slave_idx]] - diff_response_time; 
+	}else{
+		// every slave takes a part
+		double diff_workload = std::max(0.0, total_workload - cur_workload);
 
 		// add the last inv_b to the sum_inv_b
-		sum_inv_b += (1 / copy[size-1].get_avg_rendering_factor());
+		sum_inv_b += (1 / factor[order[size-1]]);
 
 		double diff_response_time = diff_workload / sum_inv_b;
-		balanced_resp_time = copy[size-1].get_avg_network_latency() 
-								+ diff_response_time; 
-	}else{
-		// std::cout<<"ccc"<<std::endl;
-		balanced_resp_time = copy[size-1].get_avg_network_latency();
+		balanced_resp_time = latency[order[size-1]] + diff_response_time; 
 	}
 
 	// calculate the workload for each slave
 	for(int i=0;i<size;i++)
 	{
-		double delt_y = balanced_resp_time - copy[i].get_avg_network_latency();
+		double delt_y = balanced_resp_time - latency[i];
 
 		if(delt_y <= 0)
-			output[copy[i].idx] = 0;
+			output[i] = 0;
 		else
-			output[copy[i].idx] = (delt_y / copy[i].get_avg_rendering_factor()) / total_workload;
+			output[i] = (delt_y / factor[i]) / total_workload;
 	}
 }
-
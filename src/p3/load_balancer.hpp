@@ -2,13 +2,13 @@
 
 // forward declarations
 class SlaveInfo;
-class RaytracerApplication;
 
 class LoadBalancer
 {
 	public:
 
-	static void calc(const RaytracerApplication* app, SlaveInfo* input, double* output, int size);
+	// total_workload is the predicted cost of the frame
+	static void calc(SlaveInfo* input, double* output, int size, double total_workload);
 
 	// receives input with varying numbers
 	// this function will populate the output 
@@ -22,6 +22,10 @@ class LoadBalancer
 
 	static void calc_static_naive_mean(SlaveInfo* input, double* output, int size);
 
+	// forgets what the strategies kept from the frames before,
+	// so that the next frame starts a new run
+	static void reset();
+
 	// no matter the input, will populate the output 
 	// with equal weight for all elements
 	static void calc_equal(SlaveInfo* input, double* output, int size);
@@ -29,6 +33,31 @@ class LoadBalancer
 	
 	static void calc_ab(SlaveInfo* input, double* output, int size, double total_workload);
 
+	// same model as calc_ab, but using the exponentially weighted estimates
+	// of each slave, so it tracks slaves getting slower or faster. 
+	// The rendering factor is taken at its upper confidence bound, 
+	// noisy slaves get a bit less work. The time to transfer the rows
+	// back is added to it, slaves on slow links get fewer rows even 
+	// if they render fast. Slaves without any estimate get none
+	static void calc_adaptive(SlaveInfo* input, double* output, int size, double total_workload);
+
+	// folds the slave's last measured rendering factor and network
+	// latency into its estimates. Call it once per response
+	static void update_estimates(SlaveInfo& si);
+
+	// folds a ping probe into the slave's clock offset. master_send and 
+	// master_receive are on our clock, the others on the slave's
+	static void update_clock_offset(SlaveInfo& si, double master_send, 
+		double slave_receive, double slave_send, double master_receive);
+
+	// predicted time for the slave to return 'rows' rows of the given cost
+	static double predict_response_duration(const SlaveInfo& si, double cost, int rows);
+
 	private:
 	LoadBalancer();	
+
+	// finds the response time at which every slave i, answering in
+	// latency[i] + factor[i] * rows, is done with total_workload rows
+	// and populates output with each slave's share of the rows
+	static void calc_min_max(const double* latency, const double* factor, double* output, int size, double total_workload);
 };
\ No newline at end of file
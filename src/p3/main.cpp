@@ -12,12 +12,21 @@
 #include "cycleTimer.h"
 #include "constants.hpp"
 #include "PoolScene.hpp"
+#include "math/random462.hpp"
 
 #include "master.hpp"
 #include "slave.hpp"
 #include "slave_info.hpp"
 #include "base64.h"
 #include "load_balancer.hpp"
+#include "frame_pool.hpp"
+#include "row_cost_model.hpp"
+#include "bench_report.hpp"
+#include "tile_stats.hpp"
+#include "slave_history.hpp"
+#include "session_scheduler.hpp"
+#include "render_service.hpp"
+#include "protocol.hpp"
 #include "raytracer_application.hpp"
 #include "options.hpp"
 #include "time.h"
@@ -26,12 +35,22 @@
 #include <stdlib.h>
 #include <iostream>
 #include <cstring>
+#include <cstddef>
 #include <string>
 #include <climits>
+#include <cfloat>
 #include <vector>
 #include <cstdlib>
 #include <cmath>
 #include <unistd.h>
+#include <atomic>
+#include <thread>
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
 
 static GLenum PIXEL_FORMAT = GL_RGB;
 
@@ -41,16 +60,22 @@ PoolScene poolScene;
 CudaScene cudaScene;
 
 static int mode;
+// without a render mode on the command line, the fastest
+// backend of the benchmark is used (see pick_backend)
+static bool mode_given = false;
 
 static Master* master;
 static Slave* slave;
 static bool paused;
 // offset for slave buffer
-// the first double is used to store the rendering latency
-static const int slave_buffer_img_offset = sizeof(double);
+// the tile's header and its rendering latency go in front of the pixels
+static const int slave_buffer_img_offset = sizeof(WireHeader) + sizeof(TilePrefix);
 
 // master's related variable
-static int buffer_frame_height = 0;
+// work of the current frame received so far, rows times the samples of 
+// each of their pixels. The receive threads add to it, whoever 
+// completes the frame hands it to the update thread
+static std::atomic<int> buffer_frame_work(0);
 static bool send_scene_status = false; // can we send scene data to slave?
 static SlaveInfo slaves_info[MAX_SLAVE] = {0}; // zero initialize array
 static double slaves_weight[MAX_SLAVE] = {0}; // zero initialize array
@@ -59,10 +84,195 @@ static RaytracerApplication* s_app = nullptr;
 static int master_render_frame_counter = 0;
 static int master_render_frame_print_time = 20;
 static int master_render_frame_rate_counter_start = 0;
-
+// frames the slaves' image pieces are assembled into
+static const int master_frame_pool_size = 3;
+static FramePool* frame_pool = nullptr;
+// frame currently being assembled, nullptr if none
+static unsigned char* assembly_frame = nullptr;
+// lock-free handoff of a completed frame from 
+// the receive threads to the update thread
+static std::atomic<unsigned char*> completed_frame(nullptr);
+// id of the frame being assembled, and the scene it was assigned with
+static unsigned int assembly_frame_id = 0;
+static CudaScene assembly_scene;
+// work that completes the frame being assembled, the whole image on 
+// master and the region master asked for on a relay
+static int assembly_work = HEIGHT * NSAMPLES * NSAMPLES;
+// with SPLIT_SAMPLES, the slaves' tiles are added up here in linear color,
+// weighted by their number of samples, and resolved into the frame once complete
+static std::vector<float> sample_accum;
+static boost::mutex sample_accum_mutex;
+// a tile's 8 bit colors back to linear, the renderers store their square root
+static float gamma_decode[256];
+
+// progressive's related variable
+// cumulative samples of the passes of a progressive strip. Master 
+// plans its frames with the first pass, the preview
+static const int progressive_passes[] = {1, 5, NSAMPLES * NSAMPLES};
+static const int progressive_pass_count = sizeof(progressive_passes) / sizeof(progressive_passes[0]);
+// the passes after the preview are rendered this many rows at a time,
+// a new scene waits at most that long to cancel the refinements
+static const int progressive_chunk_rows = 32;
+// rows a slave keeps refining once its preview was delivered. Dropped
+// when the slave is given new work or the frame goes back to the pool
+struct RefineTarget
+{
+	unsigned int frame_id;
+	unsigned char* frame;
+	int y0;
+	int height;
+};
+static RefineTarget refine_target[MAX_SLAVE];
+static boost::mutex refine_mutex[MAX_SLAVE];
+// the frame in flight is cut into a strip per slot: its rows, samples
+// and predicted cost, and when its slave is late with it. Only the
+// update thread uses them (see assign_work and speculate_stragglers),
+// the slot's SlaveInfo is reset when another slave takes it
+struct Strip
+{
+	int y0;
+	int height;
+	int sample0;
+	int sample_count;
+	double cost;
+	double deadline;
+};
+static Strip strips[MAX_SLAVE];
+// for each strip, the id of the frame it is still missing from,
+// or 0 once a slave claimed it. Whichever reply claims it first is used
+static std::atomic<unsigned int> strip_open_frame[MAX_SLAVE];
+// set while a slave has a job we haven't received back yet
+static std::atomic<bool> slave_busy[MAX_SLAVE];
+// slaves can join and leave at any time, a slot is reused by the next slave
+static std::atomic<bool> slave_connected[MAX_SLAVE];
+// a slave that said hello waits with it until the update thread gives
+// it its slot (see admit_slaves). The update thread reads slaves_info,
+// the slot is only reset there
+static HelloPayload joining_hello[MAX_SLAVE];
+static std::atomic<bool> slave_joining[MAX_SLAVE];
+// goes up when a slave connects to the slot and when it leaves, a
+// hello is only admitted if its slave hasn't left since
+static std::atomic<unsigned int> slot_epoch[MAX_SLAVE];
+static unsigned int joining_epoch[MAX_SLAVE];
+// an admitted slave left, the update thread keeps its estimates 
+// in the slave history before the slot is given to another slave
+static std::atomic<bool> slave_left[MAX_SLAVE];
+// a strip is re-issued once it takes more than 
+// this factor times its predicted response time
+static const double straggler_deadline_factor = 2.0;
+static const double straggler_min_deadline = 0.005;
+
+// how often the slaves' clock offsets are probed, in seconds
+static const double probe_interval = 1.0;
+static double last_probe_time = 0;
+// slave a strip was re-issued to, -1 if none
+static int strip_backup[MAX_SLAVE];
+static int speculative_jobs_sent = 0;
+static std::atomic<int> wasted_jobs(0);
+// predicted cost of each row, the image is cut at equal cost
+static RowCostModel* row_cost = nullptr;
+// frame and response times of a benchmark run, nullptr if not benchmarking
+static BenchReport* bench = nullptr;
+// which slave rendered which strip, with -tiles
+static StripMap* strip_map = nullptr;
+static SlaveHistory* slave_history = nullptr;
+static const char* mode_names[] = {"cuda", "simd", "single"};
+static const int mode_count = sizeof(mode_names) / sizeof(mode_names[0]);
+
+// rows of the middle of the frame the backends are timed on
+static const int benchmark_rows = 16;
+// rows per second of the backend in use, told to master in the hello
+static double benchmark_score = 0;
+
+// slave's render pipeline. Scenes from master are queued and rendered
+// on their own thread directly into outgoing messages, so frame N is
+// still being sent by the io thread while frame N+1 is rendered
+static const int slave_render_buffers = 2;
+struct PendingScene
+{
+	CudaScene scene;
+	unsigned int frame_id;
+	// the result is only sent on the connection the scene came from
+	unsigned int connection_id;
+	double received_time;
+	bool progressive;
+};
+static std::deque<PendingScene> slave_pending_scenes;
+static boost::mutex slave_pending_mutex;
+static boost::condition_variable slave_pending_cond;
+
+// relay's related variable
+// a relay takes the jobs of its master the way a slave does, splits 
+// each region among its own slaves like master splits a frame, and 
+// sends the assembled region back as a single tile. Its master sees 
+// one fast slave, so a tree of relays goes past MAX_SLAVE
+static PendingScene relay_job;
+// the relay connects to its master once it has its minimum of slaves
+static std::atomic<bool> relay_upstream_started(false);
+
+// master's own worker. It takes a share of every frame like a slave
+// and renders it on a thread of its own straight into the frame being
+// assembled. It has the slot after the slaves', -1 if master doesn't render
+static int local_worker = -1;
+struct LocalJob
+{
+	CudaScene scene;
+	unsigned char* frame;
+};
+static std::deque<LocalJob> local_jobs;
+static boost::mutex local_jobs_mutex;
+static boost::condition_variable local_jobs_cond;
+// where the worker renders when its pixels don't go straight into the frame
+static unsigned char* local_buffer = nullptr;
+
+// frame split's related variable
+// the scenes of a sequence are recorded up front, and each frame
+// goes whole to the next idle slave. Nobody waits for anybody
+static const double sequence_frame_time = 1.0 / 20;
+static const int sequence_default_frames = 300;
+static std::vector<CudaScene> sequence;
+// frames nobody was given yet, and the frame each slave renders or -1.
+// Only used by the update thread
+static std::deque<int> sequence_todo;
+static int sequence_job[MAX_SLAVE];
+static std::unique_ptr<std::atomic<bool>[]> sequence_delivered;
+static std::atomic<int> sequence_frames_done(0);
+static double sequence_start_time = 0;
+
+// multi-session related variables
+// the tables master serves. Each slave renders a frame of one of them
+// at a time, like a frame of a sequence
+static SessionScheduler* sessions = nullptr;
+static const int session_max_in_flight = 2;
+// session of each slave's frame or -1, and the session's number for it.
+// Set by the update thread before the job is sent
+static int session_job[MAX_SLAVE];
+static unsigned int session_job_number[MAX_SLAVE];
+// every session frame sent gets its own frame id
+static unsigned int session_frame_id = 0;
+// the newest frame of the shown session put on display
+static unsigned int session_shown_number = 0;
+static boost::mutex session_display_mutex;
+static const double session_stats_interval = 5.0;
+static double session_stats_time = 0;
+
+void slave_render_loop();
+void local_render_loop();
 void on_master_connection_started(Connection& conn);
+void on_master_connection_closed(int conn_idx);
 void on_master_receive_message(int conn_idx, const Message& message);
+unsigned char* on_master_payload_destination(int conn_idx, const Message& prefix, int payload_length);
 void on_slave_receive_message(const Message& message);
+void on_slave_connected();
+static void start_slave(const Options& options);
+static void pick_backend();
+static void init_cuda();
+static int get_vector_width();
+static void get_host_name(char* host, int size);
+static void save_slave_history();
+static void admit_slaves();
+static void write_strip_map();
+static void create_sessions(const std::vector<SessionOptions>& options, const Camera& camera);
 
 #define KEY_RAYTRACE_GPU SDLK_g
 
@@ -103,50 +313,114 @@ bool RaytracerApplication::initialize()
 	camera_control.camera = &poolScene.camera;
 	if (!buffer) {
 		if(options.slave) {
-			buffer = new unsigned char [WIDTH * HEIGHT * PIXEL_SIZE + slave_buffer_img_offset];
+			// slave renders straight into its outgoing messages
+		}else if(options.master || options.relay) {
+			// master displays frames from its pool, where 
+			// the slaves' pieces are assembled. A relay 
+			// only uses the rows of its region
+			frame_pool = new FramePool(WIDTH * HEIGHT * PIXEL_SIZE, master_frame_pool_size);
+			buffer = frame_pool->acquire();
+			row_cost = new RowCostModel();
+			if(options.master && options.bench_frames > 0)
+				bench = new BenchReport();
+			if(options.master && !options.tiles_output.empty())
+				strip_map = new StripMap();
+			if(!options.slave_history.empty()) {
+				slave_history = new SlaveHistory();
+				if(!slave_history->load(options.slave_history))
+					std::cout<<"can't read slave history "<<options.slave_history<<std::endl;
+			}
 		}else{
 			buffer = new unsigned char [WIDTH * HEIGHT * PIXEL_SIZE];
 		}
-
-		// master needs additional buffer for double buffering
-		if(options.master) {
-			back_buffer = new unsigned char [WIDTH * HEIGHT * PIXEL_SIZE];
-		}		
 	}
 
 	if (!options.master && !options.slave) {
 		cudaScene.y0 = 0;
 		cudaScene.render_height = HEIGHT;
 	}
+	cudaScene.sample0 = 0;
+	cudaScene.sample_count = NSAMPLES * NSAMPLES;
+
+	for(int i=0;i<256;i++) {
+		gamma_decode[i] = (i / 255.0f) * (i / 255.0f);
+	}
 
 	// CUDA part
-	cudaInitialize();
+	init_cuda();
 	simdInitialize();
 	std::cout << "Cuda initialized" << std::endl;
-	if(options.master) {
-		// initialize master
+	if(options.master || options.relay) {
+		// initialize master, a relay is one to its slaves
 
 		// master's read buffer need to be able to accomodate
 		// image that is being sent from the slave
 		Master::read_msg_max_length = WIDTH * HEIGHT * PIXEL_SIZE + 100;
-		Master::write_msg_max_length = sizeof(cudaScene);
+		Master::write_msg_max_length = sizeof(WireHeader) + scene_payload_length;
+		// enough scene messages for every slave to have one queued
+		// while the previous one is still being written
+		Master::msg_pool_size = MAX_SLAVE * 2;
+		// receive the slaves' pieces on several threads
+		Master::max_concurrent_conn = std::max(1, 
+			std::min<int>(MAX_SLAVE, std::thread::hardware_concurrency()));
+		// only the tile's header and rendering latency are read into 
+		// the message, the image goes directly into the frame being assembled
+		Master::read_msg_prefix_length = slave_buffer_img_offset;
+		Master::max_connections = options.master && options.local_slice ? MAX_SLAVE - 1 : MAX_SLAVE;
+		Master::port = options.listen_port;
 		master = &Master::start();
 		master->set_on_message_received(on_master_receive_message);
+		master->set_on_payload_destination(on_master_payload_destination);
 		master->set_on_connection_started(on_master_connection_started);
+		master->set_on_connection_closed(on_master_connection_closed);
 		master_render_frame_rate_counter_start = SDL_GetTicks();
 		send_scene_status = true;
+
+		if(options.master && options.split == SPLIT_SAMPLES)
+			sample_accum.resize(WIDTH * HEIGHT * PIXEL_SIZE);
+
+		// the camera roams the table that is shown
+		if(options.master && !options.sessions.empty()) {
+			create_sessions(options.sessions, poolScene.camera);
+			camera_control.camera = &sessions->get_scene(0).camera;
+		}
+
+		if(options.master && options.local_slice) {
+			// the last slot is ours, slaves get the others
+			local_worker = MAX_SLAVE - 1;
+
+			SlaveInfo& si = slaves_info[local_worker];
+			si = SlaveInfo();
+			si.idx = local_worker;
+			si.protocol_version = PROTOCOL_VERSION;
+			pick_backend();
+			si.backend = mode;
+			si.hardware_threads = std::thread::hardware_concurrency();
+			si.vector_width = get_vector_width();
+			si.benchmark_rows_per_second = benchmark_score;
+			get_host_name(si.host, sizeof(si.host));
+			if(!slave_history || !slave_history->seed(si))
+				si.est_rendering_factor = 1.0 / benchmark_score;
+			slave_busy[local_worker].store(false, std::memory_order_relaxed);
+			slave_connected[local_worker].store(true, std::memory_order_release);
+			if(options.split != SPLIT_ROWS)
+				local_buffer = new unsigned char[WIDTH * HEIGHT * PIXEL_SIZE];
+
+			boost::thread local_thread(local_render_loop);
+
+			// nobody to wait for
+			if(options.min_slave_to_start <= 0) {
+				if(bench)
+					bench->start();
+				app_started = true;
+			}
+		}
 	}else if(options.slave) {
-		// initialize slave
-
-		// slave only needs to read scene's data from master
-		Slave::read_msg_max_length = sizeof(cudaScene);
-		Slave::write_msg_max_length = WIDTH * HEIGHT * PIXEL_SIZE + 100;
-		slave = &Slave::start(options.host);
-		slave->set_on_message_received(on_slave_receive_message);
-		slave->set_on_socket_closed([](){
-			exit(EXIT_FAILURE);
-		});
-		slave->run();
+		// master plans our first job with the benchmark
+		pick_backend();
+		start_slave(options);
+
+		boost::thread render_thread(slave_render_loop);
 	}	
 
 	// test
@@ -157,352 +431,2252 @@ bool RaytracerApplication::initialize()
 
 void RaytracerApplication::destroy()
 {
+	if(slave_history)
+		save_slave_history();
+	if(strip_map)
+		write_strip_map();
 }
 
-Quaternion FromToRotation(Vector3 u, Vector3 v)
+// connects to master, on a relay once it has its slaves
+static void start_slave(const Options& options)
 {
-	Vector3 w = cross(u, v);
-	Quaternion q(1.f + dot(u, v), w.x, w.y, w.z);
-	return normalize(q);
+	// initialize slave
+
+	// slave only needs to read scene's data from master,
+	// a few of them if master batches them
+	Slave::read_msg_max_length = sizeof(WireHeader) 
+		+ (sizeof(WireHeader) + scene_payload_length) * slave_render_buffers * 2;
+	Slave::write_msg_max_length = WIDTH * HEIGHT * PIXEL_SIZE + 100;
+	// the image messages are the slave's render buffers
+	Slave::msg_pool_size = slave_render_buffers;
+	slave = &Slave::start(options.host, options.master_port);
+	slave->set_on_message_received(on_slave_receive_message);
+	slave->set_on_connected(on_slave_connected);
+	slave->set_on_socket_closed([](){
+		// master re-issues whatever we were given, drop it
+		boost::lock_guard<boost::mutex> lock(slave_pending_mutex);
+		slave_pending_scenes.clear();
+	});
+	slave->run();
 }
 
-int distribute(double w, int total, double& amortized)
+// puts a tile's header and prefix in front of its pixels, the scene
+// gives its rows and first sample. The times are on our clock
+static void write_tile_prefix(Message& msg, const CudaScene& scene, unsigned int frame_id,
+	int sample_count, double received_time, double render_start, double render_end, uint16_t flags)
 {
-	double real, natural;
-	real = w * total + amortized;
-	natural = std::floor(real);
-	amortized = real - natural;
-
-	return natural;
+	TilePrefix prefix;
+	prefix.rendering_latency = render_end - render_start;
+	prefix.sample0 = scene.sample0;
+	prefix.sample_count = sample_count;
+	prefix.received_time = received_time;
+	prefix.render_start = render_start;
+	prefix.render_end = render_end;
+	// see send_tile
+	prefix.send_time = 0;
+	WireHeader header = make_wire_header(WIRE_TILE, frame_id, scene.y0, scene.render_height, 
+		sizeof(prefix) + WIDTH * scene.render_height * PIXEL_SIZE);
+	header.codec = CODEC_RGB8;
+	header.flags = flags;
+	std::memcpy(msg.body(), &header, sizeof(header));
+	std::memcpy(msg.body() + sizeof(header), &prefix, sizeof(prefix));
+	msg.encode_header();
 }
 
-void assign_work()
+// sends a tile to master, once its pixels are in
+static void send_tile(MessagePtr msg)
 {
-	int n = master->get_connections_count();
+	double send_time = CycleTimer::currentSeconds();
+	std::memcpy(msg->body() + sizeof(WireHeader) + offsetof(TilePrefix, send_time),
+		&send_time, sizeof(send_time));
+	slave->send(msg);
+}
 
-	if(n == 0 || !send_scene_status)
+// sends the region assembled for relay_job to master as one tile
+static void forward_region(const unsigned char* frame)
+{
+	// we reconnected since, master already re-issued it
+	if(relay_job.connection_id != slave->get_connection_id())
 		return;
-	
-	send_scene_status = false;
-	// std::cout<<std::endl;
 
-	LoadBalancer::calc(s_app, slaves_info, slaves_weight, n);
-	int sum_height = 0;	
-	double amortized = 0;
-	for(int i=0;i<n-1;i++)
-	{		
-		// always splitting equally for now
-		slaves_info[i].render_height = distribute(slaves_weight[i], HEIGHT, amortized);
-		sum_height += slaves_info[i].render_height;
-	}
-	slaves_info[n-1].render_height = HEIGHT - sum_height;
+	int y0 = relay_job.scene.y0;
+	int height = relay_job.scene.render_height;
+	int image_length = WIDTH * height * PIXEL_SIZE;
 
-	int cur_y0 = 0;
-	for(int i=0;i<n;i++)
-	{		
-		// dont' send message if we don't have any workload for slave
-		if(slaves_info[i].render_height == 0) {
-			continue;
-		} 
+	MessagePtr msg = slave->create_message(slave_buffer_img_offset + image_length);
 
-		slaves_info[i].y0 = cur_y0;
-		cudaScene.y0 = slaves_info[i].y0;
-		cudaScene.render_height = slaves_info[i].render_height;
-		slaves_info[i].send_time = CycleTimer::currentSeconds();
+	// to master, the time our slaves took is our rendering time
+	write_tile_prefix(*msg, relay_job.scene, relay_job.frame_id, relay_job.scene.sample_count,
+		relay_job.received_time, relay_job.received_time, CycleTimer::currentSeconds(), 0);
+	std::memcpy(msg->body() + slave_buffer_img_offset, frame + y0 * WIDTH * PIXEL_SIZE, image_length);
 
-		master->send(i, cudaScene);
+	send_tile(msg);
+}
 
-		cur_y0 += slaves_info[i].render_height;
-	}
+Quaternion FromToRotation(Vector3 u, Vector3 v)
+{
+	Vector3 w = cross(u, v);
+	Quaternion q(1.f + dot(u, v), w.x, w.y, w.z);
+	return normalize(q);
 }
 
-void RaytracerApplication::update( float delta_time )
+// slots of the slaves, and of master's own worker after them
+static int get_workers_count()
 {
-	// don't update until we are ready to start 
-	if (options.slave || options.master) {
-		if(!app_started)
-			return;
-	}
+	if(local_worker >= 0)
+		return local_worker + 1;
+	return master->get_connections_count();
+}
 
-	cur_frame_number = (cur_frame_number + 1) % UINT_MAX;
-	camera_control.update(delta_time);
-	if (options.master) {
-		time += delta_time;
-		if (!paused) {
-			poolScene.update(delta_time);
-		}
-		poolScene.toCudaScene(cudaScene);
-		assign_work();
-	} else if (!options.slave) {
-		// not master and not slave
-		time += delta_time;
-		poolScene.update(delta_time);
-		poolScene.toCudaScene(cudaScene);
-		if (mode == 0) {
-			cudaRayTrace(&cudaScene, buffer);
-		} else if (mode == 1) {
-			simdRayTrace(&cudaScene, buffer);
-		} else {
-			singleRayTrace(&cudaScene, buffer);
-		}
-	}
+// a relay always splits its region by rows
+static SplitMode get_split_mode()
+{
+	if(s_app->options.relay)
+		return SPLIT_ROWS;
+	return s_app->options.split;
 }
 
-void RaytracerApplication::render()
+static bool is_progressive()
 {
-	glViewport( 0, 0, WIDTH, HEIGHT );
-	glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
+	return s_app->options.progressive && !s_app->options.relay 
+		&& get_split_mode() == SPLIT_ROWS;
+}
 
-	// reset matrices
-	glMatrixMode( GL_PROJECTION );
-	glLoadIdentity();
-	glMatrixMode( GL_MODELVIEW );
-	glLoadIdentity();
+// a seeded run (see random_seed) renders the same samples on cuda
+// too. Otherwise every process gets its own sequences, so renderers
+// sharing the samples of a pixel don't all draw the same numbers
+static void init_cuda()
+{
+	cudaInitialize(random_generator_seed());
+}
 
-	glColor4d( 1.0, 1.0, 1.0, 1.0 );
-	glRasterPos2f( -1.0f, -1.0f );
-	if (!options.slave) {
-		glDrawPixels( WIDTH, HEIGHT, PIXEL_FORMAT, GL_UNSIGNED_BYTE, &buffer[0] );
+static void render_scene(CudaScene& scene, unsigned char* img)
+{
+	if (mode == 0) {
+		cudaRayTrace(&scene, img);
+	} else if (mode == 1) {
+		simdRayTrace(&scene, img);
+	} else {
+		singleRayTrace(&scene, img);
 	}
 }
 
-void RaytracerApplication::handle_event( const SDL_Event& event )
+// rows per second the backend in use renders the middle 
+// of the frame at, with all of their samples
+static double benchmark_backend()
 {
-	camera_control.handle_event( event );
+	CudaScene scene;
+	poolScene.toCudaScene(scene);
+	scene.y0 = (HEIGHT - benchmark_rows) / 2;
+	scene.render_height = benchmark_rows;
+	scene.sample0 = 0;
+	scene.sample_count = NSAMPLES * NSAMPLES;
 
-	switch ( event.type )
-	{
-	case SDL_KEYDOWN:
-		switch ( event.key.keysym.sym )
-		{
-		case KEY_RAYTRACE_GPU:
-			poolScene.balls[0].velocity += Vector3(0.0, 0.0, -5.0);
-			break;
-		case SDLK_h:
-			paused = !paused;
-			break;
-		default:
-			break;
+	std::vector<unsigned char> img(WIDTH * benchmark_rows * PIXEL_SIZE);
+
+	// the first run only warms up the caches and the device
+	render_scene(scene, img.data());
+
+	double start = CycleTimer::currentSeconds();
+	render_scene(scene, img.data());
+	double duration = std::max(1e-6, CycleTimer::currentSeconds() - start);
+
+	return benchmark_rows / duration;
+}
+
+// times the backend given on the command line, or
+// every backend and keeps the fastest
+static void pick_backend()
+{
+	if(mode_given) {
+		benchmark_score = benchmark_backend();
+	} else {
+		int best = mode;
+		benchmark_score = 0;
+		for(mode = 0; mode < mode_count; mode++) {
+			double score = benchmark_backend();
+			std::cout<<"benchmark "<<mode_names[mode]<<": "<<score<<" rows/s"<<std::endl;
+			if(score > benchmark_score) {
+				benchmark_score = score;
+				best = mode;
+			}
 		}
-	default:
-		break;
+		mode = best;
 	}
+
+	std::cout<<"rendering with "<<mode_names[mode]<<", "
+		<<benchmark_score<<" rows/s"<<std::endl;
 }
 
-void RaytracerApplication::do_gpu_raytracing()
+// floats the cpu handles per vector instruction
+static int get_vector_width()
 {
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx512f"))
+		return 16;
+	if(__builtin_cpu_supports("avx"))
+		return 8;
+	if(__builtin_cpu_supports("sse"))
+		return 4;
+#endif
+	return 1;
 }
 
-void RaytracerApplication::swap_buffer()
+// zero terminated, empty if it can't be found
+static void get_host_name(char* host, int size)
 {
-	unsigned char* temp = buffer;
-	buffer = back_buffer;
-	back_buffer = temp;
+	std::memset(host, 0, size);
+	if(gethostname(host, size - 1) != 0)
+		host[0] = 0;
 }
 
-static bool parse_args( Options* opt, int argc, char* argv[] )
+// keeps what was learnt about the slaves that left since the last 
+// call. Returns false if none did
+static bool record_departed_slaves()
 {
-	for (int i = 1; i < argc; i++)
+	bool left = false;
+	for(int i=0;i<MAX_SLAVE;i++)
 	{
-		if(strcmp(argv[i] + 1, "master") == 0) {    		
-			opt->master = true;
-
-			if(i+1 > argc-1) {
-				std::cout<<"master needs number of minimum connected slaves"<<std::endl;
-				return false;
-			}
-			
-			// we assume the next parameter for master
-			// is the minimum slave required to begin application
-			opt->min_slave_to_start = std::atoi(argv[i + 1]);    		
-
+		if(!slave_left[i].exchange(false, std::memory_order_acq_rel))
 			continue;
-		}
-		else if(strcmp(argv[i] + 1, "slave") == 0) {
-			// slave needs host address
-			if(i+1 > argc-1) {
-				std::cout<<"slave needs host address"<<std::endl;
-				return false;
-			}
+		slave_history->record(slaves_info[i]);
+		left = true;
+	}
+	return left;
+}
 
-			opt->slave = true;
-			opt->host = argv[i + 1]; // we assume the next parameter is the master's host for the slave to connect to
-			i++;
-			continue;
-		}
+// keeps what was learnt about the connected slaves for the next run
+static void save_slave_history()
+{
+	record_departed_slaves();
+	for(int i=0;i<get_workers_count();i++) {
+		if(slave_connected[i].load(std::memory_order_acquire))
+			slave_history->record(slaves_info[i]);
 	}
-	if (argc >= 4) {
-		char *arg = argv[3];
-		if (strcmp(arg, "cuda") == 0) {
-			mode = 0;
-		} else if (strcmp(arg, "simd") == 0) {
-			mode = 1;
-		} else if (strcmp(arg, "single") == 0) {
-			mode = 2;
-		}
+	if(!slave_history->save(s_app->options.slave_history))
+		std::cout<<"can't write slave history "<<s_app->options.slave_history<<std::endl;
+}
+
+// adds size bytes of 8 bit colors to accum, in linear color.
+// This is only close to rendering all the samples in one go: the 
+// renderers clamp each part's average to 1 and round it to 8 bits 
+// after the square root, before it is decoded here. Pixels brighter 
+// than 1 come out darker, and each part adds its rounding error
+static void add_samples(float* accum, const unsigned char* pixels, int size, int sample_count)
+{
+	for(int i=0;i<size;i++) {
+		accum[i] += gamma_decode[pixels[i]] * sample_count;
 	}
-	return true;
 }
 
-using namespace std;
+// the average of sample_count samples in accum, back to the renderers' 8 bit colors
+static void resolve_samples(unsigned char* pixels, const float* accum, int size, int sample_count)
+{
+	float inv_count = 1.0f / sample_count;
+	for(int i=0;i<size;i++) {
+		pixels[i] = std::min(255.0f, std::sqrt(accum[i] * inv_count) * 255.0f + 0.5f);
+	}
+}
 
-void on_master_connection_started(Connection& conn)
+// renders the scene's samples in the passes of progressive_passes. After 
+// each pass, send_pass is given the blend of the passes so far, the 
+// samples in it and the time the pass took. Before each chunk of 
+// progressive_chunk_rows of the passes after the first, stops if 
+// cancelled() says so
+static void render_progressive(CudaScene scene, std::vector<unsigned char>& pass_img,
+	std::vector<unsigned char>& blend_img, std::vector<float>& accum,
+	const std::function<void(const unsigned char* img, int samples, double rendering_start, double rendering_end, bool last)>& send_pass,
+	const std::function<bool()>& cancelled)
 {
-	int n = master->get_connections_count();
+	int size = WIDTH * scene.render_height * PIXEL_SIZE;
+	pass_img.resize(size);
+	blend_img.resize(size);
+	accum.assign(size, 0.0f);
+
+	int y0 = scene.y0;
+	int y_end = scene.y0 + scene.render_height;
+	int sample0 = scene.sample0;
+	int total = scene.sample_count;
+	int done = 0;
+	for(int pass=0;done<total;pass++)
+	{
+		int end = pass < progressive_pass_count ? std::min(total, progressive_passes[pass]) : total;
+		if(end <= done)
+			continue;
 
-	slaves_info[conn.idx].idx = conn.idx;
+		// the preview in one go, the rest in chunks of rows
+		int chunk_rows = done > 0 ? progressive_chunk_rows : y_end - y0;
+		scene.sample0 = sample0 + done;
+		scene.sample_count = end - done;
+		double rendering_start = CycleTimer::currentSeconds();
+		for(int y=y0;y<y_end;y+=chunk_rows)
+		{
+			if(done > 0 && cancelled())
+				return;
+			scene.y0 = y;
+			scene.render_height = std::min(chunk_rows, y_end - y);
+			render_scene(scene, pass_img.data() + (y - y0) * WIDTH * PIXEL_SIZE);
+		}
+		double rendering_end = CycleTimer::currentSeconds();
 
-	if(n >= s_app->options.min_slave_to_start) {
-		// minimum slave count is reached, now
-		// we can start running the application
-		app_started = true;
+		add_samples(accum.data(), pass_img.data(), size, end - done);
+		done = end;
+		resolve_samples(blend_img.data(), accum.data(), size, done);
+		send_pass(blend_img.data(), done, rendering_start, rendering_end, done == total);
 	}
 }
 
-void calc_perf()
+// slave-i's preview of the frame was delivered, its refinements go to the same rows
+static void start_refinement(int slave_idx, unsigned int frame_id, unsigned char* frame, int y0, int height)
 {
-	static int count = 0;
-	int n = master->get_connections_count();
-	double mean = 0;
-	double max_resp_time = -1;
-	for(int i=0;i<n;i++) {
-		mean += slaves_info[i].response_duration;
-		if(max_resp_time < slaves_info[i].response_duration) {
-			max_resp_time = slaves_info[i].response_duration;
-		}
-	}
+	boost::lock_guard<boost::mutex> lock(refine_mutex[slave_idx]);
+	RefineTarget& target = refine_target[slave_idx];
+	target.frame_id = frame_id;
+	target.frame = frame;
+	target.y0 = y0;
+	target.height = height;
+}
 
-	mean /= n;
+static void stop_refinement(int slave_idx)
+{
+	boost::lock_guard<boost::mutex> lock(refine_mutex[slave_idx]);
+	refine_target[slave_idx].frame_id = 0;
+}
 
-	double sqr_diff = 0;
-	for(int i=0;i<n;i++) {
-		sqr_diff += std::pow(slaves_info[i].response_duration - mean, 2);
+// nobody writes into the frame anymore, it can go back to the pool
+static void forget_refinements(const unsigned char* frame)
+{
+	for(int i=0;i<MAX_SLAVE;i++) {
+		boost::lock_guard<boost::mutex> lock(refine_mutex[i]);
+		if(refine_target[i].frame == frame)
+			refine_target[i].frame_id = 0;
 	}
-	sqr_diff /= n;
+}
 
-	double standard_dev = std::sqrt(sqr_diff);
+// puts a refinement of slave-i's rows where its preview went, 
+// unless the frame is gone or the slave was given new work
+static void deliver_refinement(int slave_idx, unsigned int frame_id, int y0, int height, 
+	const unsigned char* pixels, bool last)
+{
+	boost::lock_guard<boost::mutex> lock(refine_mutex[slave_idx]);
+	RefineTarget& target = refine_target[slave_idx];
+	if(target.frame_id == 0 || target.frame_id != frame_id 
+		|| target.y0 != y0 || target.height != height)
+		return;
 
-	// std::cout<<"stan dev : "<<count<<" "<<standard_dev<<std::endl;
-	// std::cout<<"max resp : "<<count<<" "<<max_resp_time<<std::endl;
-	std::cout<<standard_dev<<","<<max_resp_time<<std::endl;
-	count++;
+	std::memcpy(target.frame + y0 * WIDTH * PIXEL_SIZE, pixels, height * WIDTH * PIXEL_SIZE);
+	if(last)
+		target.frame_id = 0;
 }
 
-void on_master_receive_message(int conn_idx, const Message& message)
+// true if the scenes only differ in their rows and samples
+static bool same_scene(const CudaScene& a, const CudaScene& b)
 {
-	// measure timing here	
-	// double start_process_message = CycleTimer::currentSeconds();
-
-	// std::cout<<"start processing message from slave"<<std::endl;
-	// printf("start process %d\n", conn_idx);
+	std::vector<char> encoded_a(scene_payload_length), encoded_b(scene_payload_length);
+	CudaScene b_ranges = b;
+	b_ranges.sample0 = a.sample0;
+	b_ranges.sample_count = a.sample_count;
+	encode_scene(a, encoded_a.data());
+	encode_scene(b_ranges, encoded_b.data());
+	return encoded_a == encoded_b;
+}
 
-	SlaveInfo& si = slaves_info[conn_idx];
-	si.messages_received++;	
+static void write_bench_report()
+{
+	if(!bench->write_json(s_app->options.bench_report, mode_names[mode], 
+		master->get_connections_count())) {
+		std::cout<<"can't write report to "<<s_app->options.bench_report<<std::endl;
+	}
+}
 
-	// update the slave's response time data
-	si.response_duration = CycleTimer::currentSeconds() - si.send_time;
-	si.sum_response_duration += si.response_duration;
+// which slave rendered which strip of the last frame
+static void write_strip_map()
+{
+	if(strip_map->empty())
+		return;
 
-	// grab the rendering time from the front of the message
-	std::memcpy(&si.rendering_latency, message.body(), sizeof(double));
+	std::string prefix = s_app->options.tiles_output;
+	if(!strip_map->write_csv(prefix + "strips.csv") || !strip_map->write_image(prefix + "strips.ppm")) {
+		std::cout<<"can't write strip map to "<<prefix<<std::endl;
+	}
+}
 
-	// network latency is response_duration - rendering_latency
-	si.network_latency = si.response_duration - si.rendering_latency;
-	si.sum_network_latency += si.network_latency;
+void receive_completed_frame()
+{
+	unsigned char* frame = completed_frame.exchange(nullptr, std::memory_order_acquire);
+	if(!frame)
+		return;
 
-	// calc the rendering factor
-	si.rendering_factor = si.rendering_latency / si.render_height;
-	si.sum_rendering_factor += si.rendering_factor;
+	if(strip_map && get_split_mode() == SPLIT_ROWS)
+		strip_map->complete_frame(frame);
 
-	// std::cout<<"receive msg " 
-	// 	<< conn_idx << " "
-	// 	<< si.render_height << " "
-	// 	<<"dur:"<< si.response_duration << " " 
-	// 	<<"net:"<< si.network_latency  << " " 
-	// 	<<"renlat:"<< si.rendering_latency << " " 
-	// 	<<"anet:"<< si.get_avg_network_latency() << " "
-	// 	<<"arenfac:"<< si.get_avg_rendering_factor() << " " 
-	// 	<<std::endl;
+	if(s_app->options.relay) {
+		// the region goes to our master, nothing to show
+		forward_region(frame);
+		frame_pool->release(frame);
+	} else {
+		// show the assembled frame, and give the one 
+		// that was shown before back to the pool
+		unsigned char* shown = s_app->present_frame(frame);
+		forget_refinements(shown);
+		frame_pool->release(shown);
+	}
+	assembly_frame = nullptr;
+	send_scene_status = true;
+
+	s_app->cur_render_frame_number++;
+
+	if(bench) {
+		bench->add_frame();
+		if(bench->get_frames_count() >= s_app->options.bench_frames) {
+			write_bench_report();
+			if(strip_map)
+				write_strip_map();
+			s_app->end_main_loop();
+		}
+	}
 
-	// we receive the image from slave-i	
-	int byte_offset = si.y0 * WIDTH * PIXEL_SIZE;
-	std::memcpy(s_app->back_buffer + byte_offset, message.body() + slave_buffer_img_offset, message.body_length() - sizeof(double));
+	// analytics
+	// calc_perf();
+
+	// render fps
+	master_render_frame_counter++;
+	if ( master_render_frame_counter == master_render_frame_print_time ) {
+		int curr_time = SDL_GetTicks();
+		printf("%f\n",
+			master_render_frame_print_time * 1000 / float(curr_time - master_render_frame_rate_counter_start)
+		);
+		master_render_frame_rate_counter_start = curr_time;
+		master_render_frame_counter = 0;
+
+		if(speculative_jobs_sent > 0) {
+			printf("re-issued %d straggling strips, %d results wasted\n", 
+				speculative_jobs_sent, wasted_jobs.exchange(0));
+			speculative_jobs_sent = 0;
+		}
+	}
+}
 
-	// ======== critical section ============
-	// better use locks here, if Master::max_concurrent_conn > 1
-	// Master::max_concurrent_conn is currently set to 1, because
-	// we don't notice that much difference
+// pings slave-i, see on_master_receive_pong
+static void send_probe(int slave_idx)
+{
+	ProbePayload probe;
+	std::memset(&probe, 0, sizeof(probe));
+	probe.master_send = CycleTimer::currentSeconds();
+
+	MessagePtr msg = master->create_message(sizeof(WireHeader) + sizeof(probe));
+	WireHeader header = make_wire_header(WIRE_PING, 0, 0, 0, sizeof(probe));
+	write_wire_message(msg->body(), header, reinterpret_cast<const char*>(&probe));
+	msg->encode_header();
+	master->send(slave_idx, msg);
+}
 
-	// we could only send the next scene data to slave
-	// only if we have all the image pieces from the slaves
-	int piece_height = ((message.body_length() / PIXEL_SIZE) / WIDTH);
-	buffer_frame_height += piece_height;
+// pings every slave once per probe_interval, clocks drift apart
+static void send_probes()
+{
+	double now = CycleTimer::currentSeconds();
+	if(now - last_probe_time < probe_interval)
+		return;
+	last_probe_time = now;
 
-	if(buffer_frame_height >= HEIGHT) 
-	{
-		buffer_frame_height = 0;
-		send_scene_status = true;
-		s_app->swap_buffer();
+	for(int i=0;i<master->get_connections_count();i++) {
+		if(slave_connected[i].load(std::memory_order_acquire))
+			send_probe(i);
+	}
+}
 
-		s_app->cur_render_frame_number++;
+// sends the scene's rows and samples to slave-i, or queues them 
+// for our own worker. The slave's job has to be set already
+static void send_scene(int slave_idx, const CudaScene& scene, unsigned int frame_id)
+{
+	slave_busy[slave_idx].store(true, std::memory_order_relaxed);
 
-		// analytics
-		// calc_perf();
-	
-		// render fps
-		master_render_frame_counter++;
-		if ( master_render_frame_counter == master_render_frame_print_time ) {
-			int curr_time = SDL_GetTicks();
-			printf("%f\n",
-				master_render_frame_print_time * 1000 / float(curr_time - master_render_frame_rate_counter_start)
-			);
-			master_render_frame_rate_counter_start = curr_time;
-			master_render_frame_counter = 0;
+	if(slave_idx == local_worker) {
+		LocalJob job;
+		job.scene = scene;
+		job.frame = get_split_mode() == SPLIT_ROWS ? assembly_frame : local_buffer;
+		{
+			boost::lock_guard<boost::mutex> lock(local_jobs_mutex);
+			local_jobs.push_back(job);
 		}
+		local_jobs_cond.notify_one();
+		return;
 	}
 
-	// double dur = CycleTimer::currentSeconds() - start_process_message;
-	// std::cout<<"on_master_receive_message time :  "<<dur<<std::endl;
-	// printf("finish %d\n", conn_idx);
-	// ========== end of critical section =========
+	MessagePtr msg = master->create_message(sizeof(WireHeader) + scene_payload_length);
+	WireHeader header = make_wire_header(WIRE_SCENE, frame_id, 
+		scene.y0, scene.render_height, scene_payload_length);
+	header.codec = CODEC_RGB8; // how we want the tile back
+	if(is_progressive())
+		header.flags |= WIRE_FLAG_PROGRESSIVE;
+	write_wire_message(msg->body(), header, nullptr);
+	encode_scene(scene, msg->body() + sizeof(WireHeader));
+	msg->encode_header();
+	master->send(slave_idx, msg);
 }
 
-void on_slave_receive_message(const Message& message) 
+static void send_job(int slave_idx, int strip)
 {
-	// // simulate network latency
-	// static double random_latency = (((double)rand() / RAND_MAX) *  (0.2 - 0.08) + 0.08) * 1000000; // in microseconds
-	// std::cout<<"test:"<<random_latency<<std::endl;	
-	// usleep(random_latency);
+	SlaveInfo& si = slaves_info[slave_idx];
+	si.job_strip = strip;
+	si.job_y0 = strips[strip].y0;
+	si.job_height = strips[strip].height;
+	si.job_sample0 = strips[strip].sample0;
+	si.job_sample_count = strips[strip].sample_count;
+	si.job_cost = strips[strip].cost;
+	si.job_frame = assembly_frame_id;
+	si.job_delivered = false;
+	si.send_time = CycleTimer::currentSeconds();
+	stop_refinement(slave_idx);
+
+	CudaScene scene = assembly_scene;
+	scene.y0 = si.job_y0;
+	scene.render_height = si.job_height;
+	scene.sample0 = si.job_sample0;
+	scene.sample_count = si.job_sample_count;
+	send_scene(slave_idx, scene, si.job_frame);
+}
 
-	CudaScene cudaSceneCopy;
+// claims slave-i's current job strip for the frame being assembled. 
+// Fails if another slave already delivered it or if the job is stale
+static bool claim_strip(const SlaveInfo& si)
+{
+	// no job given yet
+	if(si.job_frame == 0)
+		return false;
 
-	// calculate the rendering start time
-	double rendering_start = CycleTimer::currentSeconds();
+	unsigned int expected = si.job_frame;
+	return strip_open_frame[si.job_strip].compare_exchange_strong(expected, 0, 
+		std::memory_order_acq_rel);
+}
 
-	std::memcpy(&cudaSceneCopy, message.body(), message.body_length());
-	if (mode == 0) {
-		cudaRayTrace(&cudaSceneCopy, s_app->buffer + slave_buffer_img_offset);
-	} else if (mode == 1) {
-		simdRayTrace(&cudaSceneCopy, s_app->buffer + slave_buffer_img_offset);
+static bool is_available(int slave_idx)
+{
+	return slave_connected[slave_idx].load(std::memory_order_acquire) 
+		&& !slave_busy[slave_idx].load(std::memory_order_acquire);
+}
+
+// re-issues the strips of the frame in flight that have nobody 
+// working on them anymore (their slave left), or whose slave is 
+// straggling past its deadline
+void speculate_stragglers()
+{
+	// nothing in flight
+	if(send_scene_status || !assembly_frame)
+		return;
+
+	int n = get_workers_count();
+	double now = CycleTimer::currentSeconds();
+
+	for(int i=0;i<n;i++)
+	{
+		// delivered already, or not cut for this frame
+		if(strip_open_frame[i].load(std::memory_order_acquire) != assembly_frame_id)
+			continue;
+
+		const Strip& strip = strips[i];
+		int prev_backup = strip_backup[i];
+		bool owner_working = slave_connected[i].load(std::memory_order_acquire) 
+			&& slaves_info[i].job_strip == i && slaves_info[i].job_frame == assembly_frame_id;
+		bool backup_working = prev_backup >= 0 
+			&& slave_connected[prev_backup].load(std::memory_order_acquire);
+		bool straggling = prev_backup < 0 && now >= strip.deadline;
+
+		if((owner_working || backup_working) && !straggling)
+			continue;
+
+		// re-issue the strip to the idle slave predicted to return it the fastest
+		int backup = -1;
+		double best = 0;
+		for(int j=0;j<n;j++)
+		{
+			// the strip's own slot is only available once
+			// another slave took it, and has no job yet
+			if(!is_available(j))
+				continue;
+
+			double predicted = LoadBalancer::predict_response_duration(slaves_info[j], 
+				strip.cost, strip.height);
+			if(backup < 0 || predicted < best) {
+				backup = j;
+				best = predicted;
+			}
+		}
+
+		if(backup < 0)
+			continue;
+
+		strip_backup[i] = backup;
+		slaves_info[backup].speculative_jobs++;
+		speculative_jobs_sent++;
+		send_job(backup, i);
+	}
+}
+
+void assign_work()
+{
+	int n = get_workers_count();
+
+	if(n == 0 || !send_scene_status)
+		return;
+
+	// nothing moved, let the slaves refine what is shown
+	if(is_progressive() && assembly_frame_id > 0 && same_scene(cudaScene, assembly_scene))
+		return;
+
+	// a relay renders what its master asks for, when it asks
+	bool relay = s_app->options.relay;
+	PendingScene job;
+	if(relay) {
+		boost::lock_guard<boost::mutex> lock(slave_pending_mutex);
+		if(slave_pending_scenes.empty())
+			return;
+		job = slave_pending_scenes.front();
+	}
+
+	// grab a frame to assemble the slaves' pieces into
+	if(!assembly_frame) {
+		assembly_frame = frame_pool->acquire();
+		if(!assembly_frame)
+			return;
+	}
+
+	// a slave that just joined has no history yet, 
+	// split equally until it has, or until it told its benchmark
+	bool has_history = true;
+	for(int i=0;i<n;i++)
+	{
+		if(slave_connected[i].load(std::memory_order_acquire) && !slaves_info[i].has_estimates())
+			has_history = false;
+	}
+
+	const CudaScene& scene = relay ? job.scene : cudaScene;
+	int region_y0 = relay ? job.scene.y0 : 0;
+	int region_height = relay ? job.scene.render_height : HEIGHT;
+
+	// the weights are shares of the predicted cost of the region,
+	// which goes down with the part of the samples it has
+	row_cost->predict(scene);
+	double region_cost = row_cost->get_cost(region_y0, region_height);
+	double cost_before_region = row_cost->get_cost(0, region_y0);
+	// a progressive frame is done once its previews are in
+	int planned_samples = scene.sample_count;
+	if(is_progressive())
+		planned_samples = std::min(progressive_passes[0], scene.sample_count);
+	double sample_fraction = (double)planned_samples / (NSAMPLES * NSAMPLES);
+	double total_cost = region_cost * sample_fraction;
+
+	if(has_history) {
+		LoadBalancer::calc(slaves_info, slaves_weight, n, total_cost);
+	}else{
+		LoadBalancer::calc_equal(slaves_info, slaves_weight, n);
+	}
+
+	// a slave that left, or is still busy with a straggling job 
+	// of an earlier frame gets no work, the others share its weight
+	double sum_weight = 0;
+	int last_available = -1;
+	for(int i=0;i<n;i++)
+	{
+		if(!is_available(i)) {
+			slaves_weight[i] = 0;
+		} else {
+			last_available = i;
+		}
+		sum_weight += slaves_weight[i];
+	}
+
+	if(last_available < 0)
+		return;
+
+	if(relay) {
+		// the job is ours now, unless we lost master meanwhile
+		boost::lock_guard<boost::mutex> lock(slave_pending_mutex);
+		if(slave_pending_scenes.empty())
+			return;
+		slave_pending_scenes.pop_front();
+		relay_job = job;
+	}
+	
+	send_scene_status = false;
+	// std::cout<<std::endl;
+
+	bool sample_split = get_split_mode() == SPLIT_SAMPLES;
+	if(sample_split) {
+		// every slave renders the whole region with its share of the samples
+		int sum_samples = scene.sample0;
+		int samples_end = scene.sample0 + scene.sample_count;
+		double sum_share = 0;
+		for(int i=0;i<n;i++)
+		{
+			Strip& strip = strips[i];
+			int end_sample = sum_samples;
+			if(i == last_available) {
+				end_sample = samples_end;
+			}else if(slaves_weight[i] > 0) {
+				sum_share += slaves_weight[i] / sum_weight;
+				end_sample = scene.sample0 + (int)std::lround(sum_share * scene.sample_count);
+				end_sample = std::min(samples_end, std::max(sum_samples, end_sample));
+			}
+			strip.sample0 = sum_samples;
+			strip.sample_count = end_sample - sum_samples;
+			strip.height = strip.sample_count > 0 ? region_height : 0;
+			sum_samples = end_sample;
+		}
+
+		boost::lock_guard<boost::mutex> lock(sample_accum_mutex);
+		std::fill(sample_accum.begin(), sample_accum.end(), 0.0f);
+	} else {
+		// cut the region where the predicted cost reaches each slave's share
+		int region_end = region_y0 + region_height;
+		int sum_height = region_y0;	
+		double sum_share = 0;
+		for(int i=0;i<n;i++)
+		{		
+			strips[i].sample0 = scene.sample0;
+			strips[i].sample_count = scene.sample_count;
+			if(i == last_available || slaves_weight[i] == 0) {
+				strips[i].height = 0;
+				continue;
+			}
+			sum_share += slaves_weight[i] / sum_weight;
+			int end_row = row_cost->find_row(cost_before_region + sum_share * region_cost);
+			end_row = std::min(region_end, std::max(sum_height, end_row));
+			strips[i].height = end_row - sum_height;
+			sum_height = end_row;
+		}
+		strips[last_available].height = region_end - sum_height;
+	}
+
+	assembly_frame_id++;
+	assembly_scene = scene;
+	assembly_work = region_height * scene.sample_count;
+
+	int cur_y0 = region_y0;
+	for(int i=0;i<n;i++)
+	{		
+		SlaveInfo& si = slaves_info[i];
+		Strip& strip = strips[i];
+		strip_backup[i] = -1;
+
+		// dont' send message if we don't have any workload for slave
+		if(strip.height == 0) {
+			strip_open_frame[i].store(0, std::memory_order_relaxed);
+			continue;
+		} 
+
+		strip.y0 = cur_y0;
+		strip.cost = row_cost->get_cost(strip.y0, strip.height) 
+			* (sample_split ? strip.sample_count : planned_samples) / (NSAMPLES * NSAMPLES);
+		strip_open_frame[i].store(assembly_frame_id, std::memory_order_release);
+
+		// without any history, never speculate. A benchmark
+		// doesn't tell how long the network takes
+		if(si.messages_received == 0 && !si.est_from_history) {
+			strip.deadline = DBL_MAX;
+		} else {
+			strip.deadline = CycleTimer::currentSeconds() + std::max(straggler_min_deadline,
+				straggler_deadline_factor * LoadBalancer::predict_response_duration(si, strip.cost, strip.height));
+		}
+
+		send_job(i, i);
+
+		if(!sample_split)
+			cur_y0 += strip.height;
+	}
+}
+
+// records the scenes of the sequence rendered with SPLIT_FRAMES
+static void record_sequence()
+{
+	int frames = s_app->options.bench_frames > 0 ? s_app->options.bench_frames : sequence_default_frames;
+
+	for(int k=0;k<frames;k++)
+	{
+		poolScene.update(sequence_frame_time);
+		poolScene.toCudaScene(cudaScene);
+		CudaScene scene = cudaScene;
+		scene.y0 = 0;
+		scene.render_height = HEIGHT;
+		sequence.push_back(scene);
+		sequence_todo.push_back(k);
+	}
+
+	sequence_delivered.reset(new std::atomic<bool>[frames]());
+	std::fill(sequence_job, sequence_job + MAX_SLAVE, -1);
+	sequence_start_time = CycleTimer::currentSeconds();
+}
+
+// writes a frame as a binary ppm, top row first
+static bool write_ppm(const char* name, const unsigned char* pixels)
+{
+	FILE* file = fopen(name, "wb");
+	if(!file)
+		return false;
+
+	fprintf(file, "P6\n%d %d\n255\n", WIDTH, HEIGHT);
+	for(int y=HEIGHT-1;y>=0;y--) {
+		fwrite(pixels + y * WIDTH * PIXEL_SIZE, 1, WIDTH * PIXEL_SIZE, file);
+	}
+	fclose(file);
+	return true;
+}
+
+// the frame of slave-i's job is done
+static void deliver_sequence_frame(const SlaveInfo& si, const unsigned char* pixels)
+{
+	int k = si.job_frame - 1;
+	if(k < 0 || k >= (int)sequence.size() || sequence_delivered[k].exchange(true))
+		return;
+
+	if(!s_app->options.frames_output.empty()) {
+		char name[1024];
+		snprintf(name, sizeof(name), "%s%05d.ppm", s_app->options.frames_output.c_str(), k);
+		if(!write_ppm(name, pixels))
+			std::cout<<"can't write frame "<<k<<std::endl;
+	}
+
+	if(bench)
+		bench->add_frame();
+	sequence_frames_done++;
+}
+
+// gives the next frames of the sequence to the idle slaves, and 
+// puts back the frames of the slaves that left
+void assign_sequence()
+{
+	int n = get_workers_count();
+
+	for(int i=0;i<n;i++)
+	{
+		bool connected = slave_connected[i].load(std::memory_order_acquire);
+		bool busy = slave_busy[i].load(std::memory_order_acquire);
+		int& k = sequence_job[i];
+
+		if(k >= 0 && (!connected || !busy)) {
+			if(!sequence_delivered[k].load(std::memory_order_acquire))
+				sequence_todo.push_front(k);
+			k = -1;
+		}
+
+		if(k >= 0 || !connected || busy || sequence_todo.empty())
+			continue;
+
+		k = sequence_todo.front();
+		sequence_todo.pop_front();
+
+		row_cost->predict(sequence[k]);
+
+		SlaveInfo& si = slaves_info[i];
+		si.job_strip = i;
+		si.job_y0 = 0;
+		si.job_height = HEIGHT;
+		si.job_sample0 = sequence[k].sample0;
+		si.job_sample_count = sequence[k].sample_count;
+		si.job_cost = row_cost->get_total_cost();
+		si.job_frame = k + 1;
+		si.job_delivered = false;
+		si.send_time = CycleTimer::currentSeconds();
+		send_scene(i, sequence[k], si.job_frame);
+	}
+
+	int done = sequence_frames_done.load();
+	if(done < (int)sequence.size())
+		return;
+
+	double seconds = CycleTimer::currentSeconds() - sequence_start_time;
+	printf("rendered %d frames in %f s, %f fps\n", done, seconds, done / seconds);
+	if(bench)
+		write_bench_report();
+	s_app->end_main_loop();
+}
+
+// the tables for a multi-session master, each starting from its own break
+static void create_sessions(const std::vector<SessionOptions>& options, const Camera& camera)
+{
+	sessions = new SessionScheduler(session_max_in_flight);
+	std::fill(session_job, session_job + MAX_SLAVE, -1);
+
+	double now = CycleTimer::currentSeconds();
+	for(const SessionOptions& o : options)
+	{
+		int k = sessions->add_session(o.fps, o.weight, now);
+		PoolScene& scene = sessions->get_scene(k);
+		scene.initialize();
+		scene.camera.position = camera.position;
+		scene.camera.orientation = camera.orientation;
+		float angle = k * 0.7f;
+		scene.balls[0].velocity += Vector3(10.0 * sin(angle), 0.0, 10.0 * cos(angle));
+	}
+	session_stats_time = now;
+}
+
+// the frame of slave-i's job belongs to one of the sessions
+static void deliver_session_frame(const SlaveInfo& si, const unsigned char* pixels)
+{
+	int k = session_job[si.idx];
+	unsigned int number = session_job_number[si.idx];
+	if(k < 0)
+		return;
+
+	bool newest = sessions->deliver(k, number);
+
+	if(!s_app->options.frames_output.empty()) {
+		char name[1024];
+		snprintf(name, sizeof(name), "%ss%d_%05u.ppm", s_app->options.frames_output.c_str(), k, number);
+		if(!write_ppm(name, pixels))
+			std::cout<<"can't write frame "<<number<<" of session "<<k<<std::endl;
+	}
+
+	if(bench)
+		bench->add_frame();
+
+	// the first session is shown, an older frame never replaces a newer one
+	if(k != 0 || !newest)
+		return;
+	boost::lock_guard<boost::mutex> lock(session_display_mutex);
+	if(number <= session_shown_number)
+		return;
+	unsigned char* frame = frame_pool->acquire();
+	if(!frame)
+		return;
+	std::memcpy(frame, pixels, WIDTH * HEIGHT * PIXEL_SIZE);
+	session_shown_number = number;
+	frame_pool->release(completed_frame.exchange(frame, std::memory_order_acq_rel));
+}
+
+// a whole frame came back, of the sequence or of a session
+static void deliver_whole_frame(const SlaveInfo& si, const unsigned char* pixels)
+{
+	if(sessions) {
+		deliver_session_frame(si, pixels);
+	} else {
+		deliver_sequence_frame(si, pixels);
+	}
+}
+
+// shows the newest frame of the first session
+static void present_session_frame()
+{
+	unsigned char* frame = completed_frame.exchange(nullptr, std::memory_order_acquire);
+	if(!frame)
+		return;
+	frame_pool->release(s_app->present_frame(frame));
+	s_app->cur_render_frame_number++;
+}
+
+static void print_session_stats(double now)
+{
+	double seconds = now - session_stats_time;
+	if(seconds < session_stats_interval)
+		return;
+	session_stats_time = now;
+
+	for(int k=0;k<sessions->get_sessions_count();k++)
+	{
+		Session stats = sessions->take_stats(k);
+		printf("session %d: %.1f of %.1f fps, weight %.2f, %d late, %d skipped\n",
+			k, stats.frames_delivered / seconds, stats.target_fps, stats.weight,
+			stats.frames_late, stats.frames_skipped);
+	}
+}
+
+// gives the due frames of the sessions to the idle slaves, 
+// the session picked by the scheduler first
+static void assign_sessions()
+{
+	double now = CycleTimer::currentSeconds();
+	int n = get_workers_count();
+
+	// slaves done with their frame, or gone with it, 
+	// make room for the next frame of its session
+	for(int i=0;i<n;i++)
+	{
+		bool connected = slave_connected[i].load(std::memory_order_acquire);
+		bool busy = slave_busy[i].load(std::memory_order_acquire);
+		if(session_job[i] >= 0 && (!connected || !busy)) {
+			sessions->finish(session_job[i]);
+			session_job[i] = -1;
+		}
+	}
+
+	for(int i=0;i<n;i++)
+	{
+		if(!slave_connected[i].load(std::memory_order_acquire) 
+			|| slave_busy[i].load(std::memory_order_acquire))
+			continue;
+
+		int k = sessions->pick(now);
+		if(k < 0)
+			break;
+
+		CudaScene scene;
+		sessions->get_scene(k).toCudaScene(scene);
+		scene.y0 = 0;
+		scene.render_height = HEIGHT;
+		scene.sample0 = 0;
+		scene.sample_count = NSAMPLES * NSAMPLES;
+		row_cost->predict(scene);
+
+		SlaveInfo& si = slaves_info[i];
+		si.job_strip = i;
+		si.job_y0 = 0;
+		si.job_height = HEIGHT;
+		si.job_sample0 = scene.sample0;
+		si.job_sample_count = scene.sample_count;
+		si.job_cost = row_cost->get_total_cost();
+		si.job_frame = ++session_frame_id;
+		si.job_delivered = false;
+		si.send_time = now;
+		session_job[i] = k;
+		session_job_number[i] = sessions->issue(k, now, si.job_cost);
+		send_scene(i, scene, si.job_frame);
+	}
+
+	print_session_stats(now);
+
+	if(bench && bench->get_frames_count() >= s_app->options.bench_frames) {
+		write_bench_report();
+		s_app->end_main_loop();
+	}
+}
+
+void RaytracerApplication::update( float delta_time )
+{
+	// slaves join between frames, and we may be waiting for them
+	if (master)
+		admit_slaves();
+
+	// don't update until we are ready to start 
+	if (options.slave || options.master || options.relay) {
+		if(!app_started)
+			return;
+	}
+
+	cur_frame_number = (cur_frame_number + 1) % UINT_MAX;
+	camera_control.update(delta_time);
+	if (options.master && sessions) {
+		// every table moves on, frames are taken at each one's rate
+		for (int k = 0; k < sessions->get_sessions_count(); k++) {
+			if (!paused) {
+				sessions->get_scene(k).update(delta_time);
+			}
+		}
+		present_session_frame();
+		assign_sessions();
+		send_probes();
+	} else if (options.master && options.split == SPLIT_FRAMES) {
+		// the scenes are recorded up front, the slaves 
+		// go through them as fast as they can
+		if (sequence.empty()) {
+			record_sequence();
+		}
+		assign_sequence();
+	} else if (options.master) {
+		time += delta_time;
+		if (!paused) {
+			poolScene.update(delta_time);
+		}
+		poolScene.toCudaScene(cudaScene);
+		receive_completed_frame();
+		speculate_stragglers();
+		assign_work();
+		send_probes();
+	} else if (options.relay) {
+		// the scene comes from our master
+		receive_completed_frame();
+		speculate_stragglers();
+		assign_work();
+		send_probes();
+	} else if (!options.slave) {
+		// not master and not slave
+		time += delta_time;
+		poolScene.update(delta_time);
+		poolScene.toCudaScene(cudaScene);
+		render_scene(cudaScene, buffer);
+	}
+}
+
+void RaytracerApplication::render()
+{
+	glViewport( 0, 0, WIDTH, HEIGHT );
+	glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
+
+	// reset matrices
+	glMatrixMode( GL_PROJECTION );
+	glLoadIdentity();
+	glMatrixMode( GL_MODELVIEW );
+	glLoadIdentity();
+
+	glColor4d( 1.0, 1.0, 1.0, 1.0 );
+	glRasterPos2f( -1.0f, -1.0f );
+	if (!options.slave) {
+		glDrawPixels( WIDTH, HEIGHT, PIXEL_FORMAT, GL_UNSIGNED_BYTE, &buffer[0] );
+	}
+}
+
+void RaytracerApplication::handle_event( const SDL_Event& event )
+{
+	camera_control.handle_event( event );
+
+	switch ( event.type )
+	{
+	case SDL_KEYDOWN:
+		switch ( event.key.keysym.sym )
+		{
+		case KEY_RAYTRACE_GPU:
+			poolScene.balls[0].velocity += Vector3(0.0, 0.0, -5.0);
+			break;
+		case SDLK_h:
+			paused = !paused;
+			break;
+		default:
+			break;
+		}
+	default:
+		break;
+	}
+}
+
+void RaytracerApplication::do_gpu_raytracing()
+{
+}
+
+unsigned char* RaytracerApplication::present_frame(unsigned char* frame)
+{
+	unsigned char* prev = buffer;
+	buffer = frame;
+	return prev;
+}
+
+// host or host:port
+static void parse_host(const char* arg, std::string& host, int& port)
+{
+	host = arg;
+	size_t colon = host.rfind(':');
+	if(colon != std::string::npos) {
+		port = std::atoi(host.c_str() + colon + 1);
+		host.erase(colon);
+	}
+}
+
+static bool parse_args( Options* opt, int argc, char* argv[] )
+{
+	for (int i = 1; i < argc; i++)
+	{
+		if(strcmp(argv[i] + 1, "master") == 0) {    		
+			opt->master = true;
+
+			if(i+1 > argc-1) {
+				std::cout<<"master needs number of minimum connected slaves"<<std::endl;
+				return false;
+			}
+			
+			// we assume the next parameter for master
+			// is the minimum slave required to begin application
+			opt->min_slave_to_start = std::atoi(argv[i + 1]);    		
+
+			continue;
+		}
+		else if(strcmp(argv[i] + 1, "slave") == 0) {
+			// slave needs host address
+			if(i+1 > argc-1) {
+				std::cout<<"slave needs host address"<<std::endl;
+				return false;
+			}
+
+			opt->slave = true;
+			parse_host(argv[i + 1], opt->host, opt->master_port); // we assume the next parameter is the master's host for the slave to connect to
+			i++;
+			continue;
+		}
+		else if(strcmp(argv[i] + 1, "relay") == 0) {
+			// relay needs its master's address and 
+			// the minimum of its own slaves
+			if(i+2 > argc-1) {
+				std::cout<<"relay needs host address and number of minimum connected slaves"<<std::endl;
+				return false;
+			}
+
+			opt->relay = true;
+			parse_host(argv[i + 1], opt->host, opt->master_port);
+			opt->min_slave_to_start = std::atoi(argv[i + 2]);
+			i += 2;
+			continue;
+		}
+		else if(strcmp(argv[i] + 1, "port") == 0) {
+			if(i+1 > argc-1) {
+				std::cout<<"port needs the port to listen on"<<std::endl;
+				return false;
+			}
+
+			opt->listen_port = std::atoi(argv[i + 1]);
+			i++;
+			continue;
+		}
+		else if(strcmp(argv[i] + 1, "history") == 0) {
+			if(i+1 > argc-1) {
+				std::cout<<"history needs a file name, or none"<<std::endl;
+				return false;
+			}
+
+			opt->slave_history = strcmp(argv[i + 1], "none") == 0 ? "" : argv[i + 1];
+			i++;
+			continue;
+		}
+		else if(strcmp(argv[i] + 1, "local") == 0) {
+			opt->local_slice = true;
+			continue;
+		}
+		else if(strcmp(argv[i] + 1, "split") == 0) {
+			if(i+1 > argc-1) {
+				std::cout<<"split needs rows, samples or frames"<<std::endl;
+				return false;
+			}
+
+			const char* split = argv[i + 1];
+			if(strcmp(split, "rows") == 0) {
+				opt->split = SPLIT_ROWS;
+			} else if(strcmp(split, "samples") == 0) {
+				opt->split = SPLIT_SAMPLES;
+			} else if(strcmp(split, "frames") == 0) {
+				opt->split = SPLIT_FRAMES;
+			} else {
+				std::cout<<"split needs rows, samples or frames"<<std::endl;
+				return false;
+			}
+			i++;
+			continue;
+		}
+		else if(strcmp(argv[i] + 1, "session") == 0) {
+			if(i+1 > argc-1) {
+				std::cout<<"session needs its frame rate, and optionally its weight as fps:weight"<<std::endl;
+				return false;
+			}
+
+			// fps or fps:weight
+			SessionOptions session;
+			session.fps = std::atof(argv[i + 1]);
+			session.weight = 1.0;
+			const char* colon = strchr(argv[i + 1], ':');
+			if(colon)
+				session.weight = std::atof(colon + 1);
+			if(session.fps <= 0 || session.weight <= 0) {
+				std::cout<<"session needs a positive frame rate and weight"<<std::endl;
+				return false;
+			}
+
+			// the sessions' frames go whole to the slaves
+			opt->sessions.push_back(session);
+			opt->split = SPLIT_FRAMES;
+			i++;
+			continue;
+		}
+		else if(strcmp(argv[i] + 1, "progressive") == 0) {
+			opt->progressive = true;
+			continue;
+		}
+		else if(strcmp(argv[i] + 1, "out") == 0) {
+			if(i+1 > argc-1) {
+				std::cout<<"out needs a prefix for the frames' file names"<<std::endl;
+				return false;
+			}
+
+			opt->frames_output = argv[i + 1];
+			i++;
+			continue;
+		}
+		else if(strcmp(argv[i] + 1, "serve") == 0) {
+			if(i+1 > argc-1) {
+				std::cout<<"serve needs the path of its socket"<<std::endl;
+				return false;
+			}
+
+			opt->serve_path = argv[i + 1];
+			i++;
+			continue;
+		}
+		else if(strcmp(argv[i] + 1, "bench") == 0) {
+			opt->offline_bench = true;
+			continue;
+		}
+		else if(strcmp(argv[i] + 1, "threads") == 0) {
+			if(i+1 > argc-1) {
+				std::cout<<"threads needs the thread counts to benchmark, as 1,2,4"<<std::endl;
+				return false;
+			}
+
+			for(const char* count = argv[i + 1]; count; ) {
+				int threads = std::atoi(count);
+				if(threads <= 0) {
+					std::cout<<"threads needs positive thread counts"<<std::endl;
+					return false;
+				}
+				opt->bench_threads.push_back(threads);
+				count = strchr(count, ',');
+				if(count)
+					count++;
+			}
+			i++;
+			continue;
+		}
+		else if(strcmp(argv[i] + 1, "tiles") == 0) {
+			if(i+1 > argc-1) {
+				std::cout<<"tiles needs a prefix for the tile stats' file names"<<std::endl;
+				return false;
+			}
+
+			opt->tiles_output = argv[i + 1];
+			i++;
+			continue;
+		}
+		else if(strcmp(argv[i] + 1, "headless") == 0) {
+			opt->headless = true;
+			continue;
+		}
+		else if(strcmp(argv[i] + 1, "frames") == 0) {
+			if(i+1 > argc-1) {
+				std::cout<<"frames needs the number of frames to benchmark"<<std::endl;
+				return false;
+			}
+
+			opt->bench_frames = std::atoi(argv[i + 1]);
+			i++;
+			continue;
+		}
+		else if(strcmp(argv[i] + 1, "report") == 0) {
+			if(i+1 > argc-1) {
+				std::cout<<"report needs a file name"<<std::endl;
+				return false;
+			}
+
+			opt->bench_report = argv[i + 1];
+			i++;
+			continue;
+		}
+		// the render mode can be anywhere, a relay has more arguments before it
+		else if (strcmp(argv[i], "cuda") == 0) {
+			mode = 0;
+			mode_given = true;
+		} else if (strcmp(argv[i], "simd") == 0) {
+			mode = 1;
+			mode_given = true;
+		} else if (strcmp(argv[i], "single") == 0) {
+			mode = 2;
+			mode_given = true;
+		} else if (strcmp(argv[i], "auto") == 0) {
+			mode_given = false;
+		}
+	}
+	return true;
+}
+
+using namespace std;
+
+void on_master_connection_started(Connection& conn)
+{
+	// the slot may have been used by a slave that left, this
+	// slave starts without any history. It gets its slot and
+	// then work once it said hello (see on_master_receive_hello)
+	slot_epoch[conn.idx]++;
+	slave_joining[conn.idx].store(false, std::memory_order_relaxed);
+	slave_busy[conn.idx].store(false, std::memory_order_relaxed);
+	slave_connected[conn.idx].store(false, std::memory_order_release);
+
+	std::cout<<"slave "<<conn.idx<<" connected"<<std::endl;
+}
+
+static void on_master_receive_hello(int conn_idx, const char* payload, int length)
+{
+	// an older slave's hello is shorter, what it
+	// doesn't send is left at 0
+	HelloPayload hello;
+	std::memset(&hello, 0, sizeof(hello));
+	if(length < hello_payload_v2_length) {
+		master->close_connection(conn_idx);
+		return;
+	}
+	std::memcpy(&hello, payload, std::min<int>(length, sizeof(hello)));
+
+	// the newest version both of us speak
+	int version = std::min<int>(PROTOCOL_VERSION, hello.max_version);
+	if(version < PROTOCOL_MIN_VERSION || version < hello.min_version) {
+		std::cout<<"slave "<<conn_idx<<" speaks protocol "<<hello.min_version
+			<<" to "<<hello.max_version<<", dropping it"<<std::endl;
+		master->close_connection(conn_idx);
+		return;
+	}
+
+	WelcomePayload welcome;
+	std::memset(&welcome, 0, sizeof(welcome));
+	welcome.version = version;
+
+	MessagePtr msg = master->create_message(sizeof(WireHeader) + sizeof(welcome));
+	WireHeader header = make_wire_header(WIRE_WELCOME, 0, 0, 0, sizeof(welcome));
+	write_wire_message(msg->body(), header, reinterpret_cast<const char*>(&welcome));
+	msg->encode_header();
+	master->send(conn_idx, msg);
+
+	// the version agreed on goes with the rest of the hello
+	hello.max_version = version;
+	joining_hello[conn_idx] = hello;
+	joining_epoch[conn_idx] = slot_epoch[conn_idx];
+	slave_joining[conn_idx].store(true, std::memory_order_release);
+}
+
+// gives the slaves that said hello their slots. Runs on the update
+// thread, which may still be reading the SlaveInfo of the slave that
+// left the slot, or re-issuing its strip (see speculate_stragglers)
+static void admit_slaves()
+{
+	// slaves that left first, their slots may be joined again.
+	// The slaves still working are saved when we end
+	if(slave_history && record_departed_slaves()
+		&& !slave_history->save(s_app->options.slave_history))
+		std::cout<<"can't write slave history "<<s_app->options.slave_history<<std::endl;
+
+	bool admitted = false;
+	for(int i=0;i<master->get_connections_count();i++)
+	{
+		if(!slave_joining[i].exchange(false, std::memory_order_acq_rel)
+			|| slot_epoch[i] != joining_epoch[i])
+			continue;
+		const HelloPayload& hello = joining_hello[i];
+
+		SlaveInfo& si = slaves_info[i];
+		si = SlaveInfo();
+		si.idx = i;
+		si.protocol_version = hello.max_version;
+		si.backend = hello.backend;
+		si.hardware_threads = hello.hardware_threads;
+		si.vector_width = hello.vector_width;
+		si.benchmark_rows_per_second = hello.benchmark_rows_per_second;
+
+		std::memcpy(si.host, hello.host, sizeof(si.host));
+		si.host[sizeof(si.host) - 1] = 0;
+
+		// what a previous run learnt about the slave's host, or else its
+		// benchmark, stands in for its history until it has one.
+		// A row costs 1 on average (see RowCostModel)
+		if(slave_history && slave_history->seed(si)) {
+			std::cout<<"slave "<<i<<" starts from the history of "
+				<<SlaveHistory::get_key(si)<<std::endl;
+		} else if(si.benchmark_rows_per_second > 0) {
+			si.est_rendering_factor = 1.0 / si.benchmark_rows_per_second;
+		}
+
+		// if it left meanwhile, either its leaving (see
+		// on_master_connection_closed) or this check takes the slot back
+		slave_connected[i].store(true);
+		if(slot_epoch[i] != joining_epoch[i]) {
+			slave_connected[i].store(false);
+			continue;
+		}
+		admitted = true;
+
+		// its clock offset is known before its first tile comes
+		send_probe(i);
+
+		std::cout<<"slave "<<i<<" joined ("<<mode_names[std::min<int>(hello.backend, mode_count - 1)]
+			<<", "<<hello.hardware_threads<<" threads, "<<hello.vector_width<<" wide, "
+			<<hello.benchmark_rows_per_second<<" rows/s)"<<std::endl;
+	}
+
+	if(!admitted)
+		return;
+
+	int n = 0;
+	for(int i=0;i<master->get_connections_count();i++) {
+		if(slave_connected[i].load(std::memory_order_acquire))
+			n++;
+	}
+
+	if(n >= s_app->options.min_slave_to_start) {
+		// minimum slave count is reached, now
+		// we can start running the application
+		if(!app_started && bench)
+			bench->start();
+		app_started = true;
+
+		// a relay is ready to take work from its master
+		if(s_app->options.relay && !relay_upstream_started.exchange(true))
+			start_slave(s_app->options);
+	}
+}
+
+// slave-i's answer to a ping, it places the slave's times on our clock
+static void on_master_receive_pong(int conn_idx, const char* payload, int length)
+{
+	double received_time = CycleTimer::currentSeconds();
+	if(length < (int)sizeof(ProbePayload))
+		return;
+
+	// the slot is the slave's once it was admitted
+	if(!slave_connected[conn_idx].load(std::memory_order_acquire))
+		return;
+
+	ProbePayload probe;
+	std::memcpy(&probe, payload, sizeof(probe));
+	LoadBalancer::update_clock_offset(slaves_info[conn_idx], probe.master_send,
+		probe.slave_receive, probe.slave_send, received_time);
+}
+
+void on_master_connection_closed(int conn_idx)
+{
+	// whatever it was rendering is re-issued by speculate_stragglers,
+	// and it gets no work from the next frame on
+	slot_epoch[conn_idx]++;
+	bool admitted = slave_connected[conn_idx].exchange(false);
+
+	std::cout<<"slave "<<conn_idx<<" left"<<std::endl;
+
+	// the update thread saves what we learnt about it (see admit_slaves)
+	if(admitted && slave_history)
+		slave_left[conn_idx].store(true, std::memory_order_release);
+}
+
+void calc_perf()
+{
+	static int count = 0;
+	int n = master->get_connections_count();
+	double mean = 0;
+	double max_resp_time = -1;
+	for(int i=0;i<n;i++) {
+		mean += slaves_info[i].response_duration;
+		if(max_resp_time < slaves_info[i].response_duration) {
+			max_resp_time = slaves_info[i].response_duration;
+		}
+	}
+
+	mean /= n;
+
+	double sqr_diff = 0;
+	for(int i=0;i<n;i++) {
+		sqr_diff += std::pow(slaves_info[i].response_duration - mean, 2);
+	}
+	sqr_diff /= n;
+
+	double standard_dev = std::sqrt(sqr_diff);
+
+	// std::cout<<"stan dev : "<<count<<" "<<standard_dev<<std::endl;
+	// std::cout<<"max resp : "<<count<<" "<<max_resp_time<<std::endl;
+	std::cout<<standard_dev<<","<<max_resp_time<<std::endl;
+	count++;
+}
+
+// the tile is slave-i's current job
+static bool is_job_tile(const SlaveInfo& si, const WireHeader& header, const TilePrefix& prefix)
+{
+	return header.type == WIRE_TILE && header.codec == CODEC_RGB8
+		&& header.frame_id == si.job_frame && header.y0 == si.job_y0 
+		&& header.height == si.job_height && header.x0 == 0 && header.width == WIDTH
+		&& header.payload_length == sizeof(TilePrefix) + si.job_height * WIDTH * PIXEL_SIZE
+		&& prefix.sample0 == si.job_sample0 
+		&& ((header.flags & WIRE_FLAG_PARTIAL) ? prefix.sample_count < si.job_sample_count
+			: prefix.sample_count == si.job_sample_count);
+}
+
+// updates slave-i's history with the response to its current job.
+// The prefix of a slave's tile tells where the time went on the 
+// slave, master's own worker has none
+static void record_response(SlaveInfo& si, double rendering_latency, const TilePrefix* prefix)
+{
+	si.messages_received++;	
+
+	// update the slave's response time data
+	double receive_time = CycleTimer::currentSeconds();
+	si.response_duration = receive_time - si.send_time;
+	si.sum_response_duration += si.response_duration;
+
+	si.rendering_latency = rendering_latency;
+
+	// the time the job spent on the slave, between receiving
+	// it and sending the tile. The rest is the network's
+	double slave_time = rendering_latency;
+	si.queue_time = 0;
+	si.pack_time = 0;
+	si.downlink_latency = -1;
+	si.uplink_latency = -1;
+	if(prefix) {
+		slave_time = prefix->send_time - prefix->received_time;
+		si.queue_time = prefix->render_start - prefix->received_time;
+		si.pack_time = prefix->send_time - prefix->render_end;
+
+		// the slave's times on our clock
+		if(si.probes > 0) {
+			si.downlink_latency = std::max(0.0, prefix->received_time - si.clock_offset - si.send_time);
+			si.uplink_latency = std::max(0.0, receive_time - (prefix->send_time - si.clock_offset));
+		}
+	}
+
+	si.network_latency = si.response_duration - slave_time;
+	si.sum_network_latency += si.network_latency;
+
+	// calc the rendering factor, the time per unit of predicted cost
+	si.rendering_factor = si.job_cost > 0 ? si.rendering_latency / si.job_cost : 0;
+	si.sum_rendering_factor += si.rendering_factor;
+
+	// how far off the strip was from the prediction tells 
+	// how costly its rows really are
+	if(si.messages_received > 1) {
+		row_cost->add_measurement(si.job_y0, si.job_height, 
+			si.rendering_latency, si.est_rendering_factor * si.job_cost);
+	}
+
+	LoadBalancer::update_estimates(si);
+
+	if(bench)
+		bench->add_response(si.idx, si.response_duration, si.rendering_latency, si.network_latency,
+			si.queue_time, si.pack_time, si.downlink_latency, si.uplink_latency);
+}
+
+// adds a tile of the whole frame to the samples taken so far
+static void accumulate_samples(const unsigned char* pixels, int sample_count)
+{
+	boost::lock_guard<boost::mutex> lock(sample_accum_mutex);
+	add_samples(sample_accum.data(), pixels, WIDTH * HEIGHT * PIXEL_SIZE, sample_count);
+}
+
+// the frame out of the samples added up
+static void resolve_frame_samples(unsigned char* frame, int sample_count)
+{
+	boost::lock_guard<boost::mutex> lock(sample_accum_mutex);
+	resolve_samples(frame, sample_accum.data(), WIDTH * HEIGHT * PIXEL_SIZE, sample_count);
+}
+
+// claims slave-i's strip and puts its pixels into the frame being assembled
+static bool deliver_tile(const SlaveInfo& si, const unsigned char* pixels)
+{
+	if(!claim_strip(si))
+		return false;
+
+	if(get_split_mode() == SPLIT_SAMPLES) {
+		accumulate_samples(pixels, si.job_sample_count);
 	} else {
-		singleRayTrace(&cudaSceneCopy, s_app->buffer + slave_buffer_img_offset);
+		std::memcpy(assembly_frame + si.job_y0 * WIDTH * PIXEL_SIZE, pixels, 
+			si.job_height * WIDTH * PIXEL_SIZE);
+	}
+	return true;
+}
+
+// counts rows times samples delivered to the frame being assembled
+static void add_frame_work(int work)
+{
+	// we could only send the next scene data to slave
+	// only if we have all the image pieces from the slaves
+	int frame_work = buffer_frame_work.fetch_add(work, std::memory_order_acq_rel) 
+		+ work;
+
+	if(frame_work >= assembly_work) 
+	{
+		// we got the last piece, hand the frame to the update thread
+		if(get_split_mode() == SPLIT_SAMPLES)
+			resolve_frame_samples(assembly_frame, assembly_scene.sample_count);
+		buffer_frame_work.store(0, std::memory_order_relaxed);
+		completed_frame.store(assembly_frame, std::memory_order_release);
+	}
+}
+
+static void on_master_receive_tile(int conn_idx, const WireHeader& header, 
+	const char* payload, int available_length)
+{
+	// measure timing here	
+	// double start_process_message = CycleTimer::currentSeconds();
+
+	// std::cout<<"start processing message from slave"<<std::endl;
+	// printf("start process %d\n", conn_idx);
+
+	// refinements come after the slave's preview, when it may 
+	// have been given new work already
+	if(header.flags & WIRE_FLAG_REFINEMENT) {
+		if(available_length == (int)header.payload_length && header.x0 == 0 && header.width == WIDTH
+			&& header.payload_length == sizeof(TilePrefix) + header.height * WIDTH * PIXEL_SIZE) {
+			deliver_refinement(conn_idx, header.frame_id, header.y0, header.height,
+				reinterpret_cast<const unsigned char*>(payload + sizeof(TilePrefix)), 
+				!(header.flags & WIRE_FLAG_PARTIAL));
+		}
+		return;
+	}
+
+	// we didn't ask this slave for anything
+	if(!slave_busy[conn_idx].load(std::memory_order_acquire))
+		return;
+
+	SlaveInfo& si = slaves_info[conn_idx];
+	if(available_length < (int)sizeof(TilePrefix)) {
+		std::cout<<"unexpected tile from slave "<<conn_idx<<std::endl;
+		return;
+	}
+
+	// grab the rendering time from the front of the payload
+	TilePrefix prefix;
+	std::memcpy(&prefix, payload, sizeof(prefix));
+	if(!is_job_tile(si, header, prefix)) {
+		std::cout<<"unexpected tile from slave "<<conn_idx<<std::endl;
+		return;
+	}
+	record_response(si, prefix.rendering_latency, &prefix);
+
+	const unsigned char* pixels = reinterpret_cast<const unsigned char*>(payload + sizeof(TilePrefix));
+	bool complete = available_length == (int)header.payload_length;
+
+	// a frame of the sequence, nothing else to wait for
+	if(get_split_mode() == SPLIT_FRAMES) {
+		if(complete)
+			deliver_whole_frame(si, pixels);
+		slave_busy[conn_idx].store(false, std::memory_order_release);
+		return;
+	}
+
+	// std::cout<<"receive msg " 
+	// 	<< conn_idx << " "
+	// 	<< si.job_height << " "
+	// 	<<"dur:"<< si.response_duration << " " 
+	// 	<<"net:"<< si.network_latency  << " " 
+	// 	<<"renlat:"<< si.rendering_latency << " " 
+	// 	<<"anet:"<< si.get_avg_network_latency() << " "
+	// 	<<"arenfac:"<< si.get_avg_rendering_factor() << " " 
+	// 	<<std::endl;
+
+	// we receive the image from slave-i. The pixels are normally 
+	// already in place (see on_master_payload_destination), we only 
+	// copy them if they were delivered inside the message
+	bool delivered = si.job_delivered;
+	if(!delivered && complete) {
+		delivered = deliver_tile(si, pixels);
+	}
+	int job_work = si.job_height * si.job_sample_count;
+
+	// the refinements of a preview go where it went. Before the slave 
+	// is free, so new work can't come before and stop them
+	if(delivered && (header.flags & WIRE_FLAG_PARTIAL))
+		start_refinement(conn_idx, si.job_frame, assembly_frame, si.job_y0, si.job_height);
+
+	// slave can be given work again
+	slave_busy[conn_idx].store(false, std::memory_order_release);
+
+	// another slave delivered this strip first
+	if(!delivered) {
+		si.wasted_jobs++;
+		si.wasted_rendering_time += si.rendering_latency;
+		wasted_jobs++;
+		return;
 	}
 
-	// calculate the rendering latency
-	double rendering_latency = CycleTimer::currentSeconds() 
-		- rendering_start;
+	if(strip_map && get_split_mode() == SPLIT_ROWS)
+		strip_map->add(si.job_y0, si.job_height, conn_idx, si.host, si.rendering_latency);
 
-	// put the rendering time in front of the buffer
-	std::memcpy(s_app->buffer, &rendering_latency, sizeof(rendering_latency));
+	// this runs concurrently for different slaves (Master::max_concurrent_conn).
+	// slaves_info[conn_idx] is only touched by its connection's strand 
+	// while the frame is in flight, and the rows are counted atomically
+	add_frame_work(job_work);
 
-	int height = cudaSceneCopy.render_height;
-	slave->send(s_app->buffer, WIDTH * (height) * PIXEL_SIZE + sizeof(rendering_latency));	
+	// double dur = CycleTimer::currentSeconds() - start_process_message;
+	// std::cout<<"on_master_receive_message time :  "<<dur<<std::endl;
+	// printf("finish %d\n", conn_idx);
 }
 
-int main( int argc, char* argv[] )
+void on_master_receive_message(int conn_idx, const Message& message)
+{
+	bool valid = for_each_wire_message(message.body(), message.body_length(),
+		[conn_idx](const WireHeader& header, const char* payload, int available_length)
+		{
+			switch(header.type)
+			{
+			case WIRE_HELLO:
+				on_master_receive_hello(conn_idx, payload, available_length);
+				break;
+			case WIRE_TILE:
+				on_master_receive_tile(conn_idx, header, payload, available_length);
+				break;
+			case WIRE_PONG:
+				on_master_receive_pong(conn_idx, payload, available_length);
+				break;
+			default:
+				break;
+			}
+			return true;
+		});
+
+	if(!valid) {
+		std::cout<<"malformed message from slave "<<conn_idx<<std::endl;
+		master->close_connection(conn_idx);
+	}
+}
+
+unsigned char* on_master_payload_destination(int conn_idx, const Message& prefix, int payload_length)
+{
+	SlaveInfo& si = slaves_info[conn_idx];
+
+	// whole frames and samples to add up are read into the message
+	WireHeader header;
+	if(get_split_mode() != SPLIT_ROWS
+		|| !slave_busy[conn_idx].load(std::memory_order_acquire)
+		|| !read_wire_header(prefix.body(), prefix.body_length(), header)
+		|| prefix.body_length() != slave_buffer_img_offset
+		|| (header.flags & WIRE_FLAG_REFINEMENT))
+		return nullptr;
+
+	TilePrefix tile_prefix;
+	std::memcpy(&tile_prefix, prefix.body() + sizeof(WireHeader), sizeof(tile_prefix));
+
+	// slave-i's piece goes directly to its rows in the frame being assembled,
+	// unless another slave got that strip first, then it's read and dropped
+	if(!is_job_tile(si, header, tile_prefix) 
+		|| payload_length != si.job_height * WIDTH * PIXEL_SIZE || !claim_strip(si)) {
+		return nullptr;
+	}
+
+	si.job_delivered = true;
+	return assembly_frame + si.job_y0 * WIDTH * PIXEL_SIZE;
+}
+
+void on_slave_connected()
+{
+	HelloPayload hello;
+	std::memset(&hello, 0, sizeof(hello));
+	hello.min_version = PROTOCOL_MIN_VERSION;
+	hello.max_version = PROTOCOL_VERSION;
+	hello.backend = mode;
+	hello.hardware_threads = std::thread::hardware_concurrency();
+	hello.vector_width = get_vector_width();
+	hello.benchmark_rows_per_second = benchmark_score;
+	get_host_name(hello.host, sizeof(hello.host));
+
+	// a relay renders with all of its slaves
+	if(s_app->options.relay) {
+		int threads = 0;
+		double score = 0;
+		for(int i=0;i<master->get_connections_count();i++) {
+			if(slave_connected[i].load(std::memory_order_acquire)) {
+				threads += slaves_info[i].hardware_threads;
+				score += slaves_info[i].benchmark_rows_per_second;
+			}
+		}
+		hello.hardware_threads = std::min(threads, 0xffff);
+		hello.benchmark_rows_per_second = score;
+	}
+
+	MessagePtr msg = slave->create_message(sizeof(WireHeader) + sizeof(hello));
+	WireHeader header = make_wire_header(WIRE_HELLO, 0, 0, 0, sizeof(hello));
+	write_wire_message(msg->body(), header, reinterpret_cast<const char*>(&hello));
+	msg->encode_header();
+	slave->send(msg);
+}
+
+// answers master's ping, the probe holds the time it came in
+static void send_probe_answer(ProbePayload probe)
+{
+	MessagePtr msg = slave->create_message(sizeof(WireHeader) + sizeof(probe));
+	probe.slave_send = CycleTimer::currentSeconds();
+	WireHeader header = make_wire_header(WIRE_PONG, 0, 0, 0, sizeof(probe));
+	write_wire_message(msg->body(), header, reinterpret_cast<const char*>(&probe));
+	msg->encode_header();
+	slave->send(msg);
+}
+
+void on_slave_receive_message(const Message& message) 
+{
+	unsigned int connection_id = slave->get_connection_id();
+	double received_time = CycleTimer::currentSeconds();
+	int scenes = 0;
+
+	for_each_wire_message(message.body(), message.body_length(),
+		[connection_id, received_time, &scenes](const WireHeader& header, const char* payload, int available_length)
+		{
+			// answered right away, the render thread may be busy
+			if(header.type == WIRE_PING && available_length >= (int)sizeof(ProbePayload)) {
+				ProbePayload probe;
+				std::memcpy(&probe, payload, sizeof(probe));
+				probe.slave_receive = received_time;
+				send_probe_answer(probe);
+				return true;
+			}
+
+			if(header.type == WIRE_WELCOME && available_length >= (int)sizeof(WelcomePayload)) {
+				WelcomePayload welcome;
+				std::memcpy(&welcome, payload, sizeof(welcome));
+				std::cout<<"master speaks protocol "<<welcome.version<<std::endl;
+			}
+
+			if(header.type != WIRE_SCENE || available_length != scene_payload_length
+				|| header.codec != CODEC_RGB8 || header.x0 != 0 || header.width != WIDTH
+				|| header.y0 + header.height > HEIGHT)
+				return true;
+
+			PendingScene pending;
+			decode_scene(payload, pending.scene);
+			if(pending.scene.sample_count <= 0 
+				|| pending.scene.sample0 + pending.scene.sample_count > NSAMPLES * NSAMPLES)
+				return true;
+			pending.scene.y0 = header.y0;
+			pending.scene.render_height = header.height;
+			pending.frame_id = header.frame_id;
+			pending.connection_id = connection_id;
+			pending.received_time = received_time;
+			pending.progressive = header.flags & WIRE_FLAG_PROGRESSIVE;
+
+			// hand the scene to the render thread, the io thread 
+			// goes back to sending the previous frame
+			{
+				boost::lock_guard<boost::mutex> lock(slave_pending_mutex);
+				slave_pending_scenes.push_back(pending);
+			}
+			scenes++;
+			return true;
+		});
+
+	if(scenes > 0)
+		slave_pending_cond.notify_one();
+}
+
+static void slave_render(CudaScene& scene, unsigned int frame_id, unsigned int connection_id,
+	double received_time)
+{
+	// // simulate network latency
+	// static double random_latency = (((double)rand() / RAND_MAX) *  (0.2 - 0.08) + 0.08) * 1000000; // in microseconds
+	// std::cout<<"test:"<<random_latency<<std::endl;	
+	// usleep(random_latency);
+
+	int height = scene.render_height;
+
+	// render buffer is the message that will be sent, it comes
+	// back to the pool once it is written to the socket
+	MessagePtr msg = slave->create_message(WIDTH * height * PIXEL_SIZE + slave_buffer_img_offset);
+	unsigned char* img = reinterpret_cast<unsigned char*>(msg->body()) + slave_buffer_img_offset;
+
+	double rendering_start = CycleTimer::currentSeconds();
+	render_scene(scene, img);
+	double rendering_end = CycleTimer::currentSeconds();
+
+	// put the tile's header and the rendering times in front of the image
+	write_tile_prefix(*msg, scene, frame_id, scene.sample_count, 
+		received_time, rendering_start, rendering_end, 0);
+
+	// we reconnected while rendering, master already re-issued it
+	if(connection_id != slave->get_connection_id())
+		return;
+
+	send_tile(msg);
+}
+
+// sends a preview of the scene's rows, then refinements of it
+// until all samples are in or master sends something new
+static void slave_render_progressive(const CudaScene& scene, unsigned int frame_id, unsigned int connection_id,
+	double received_time)
+{
+	// only used by the render thread
+	static std::vector<unsigned char> pass_img, blend_img;
+	static std::vector<float> accum;
+
+	int image_length = WIDTH * scene.render_height * PIXEL_SIZE;
+	bool first = true;
+
+	render_progressive(scene, pass_img, blend_img, accum,
+		[&](const unsigned char* img, int samples, double rendering_start, double rendering_end, bool last)
+		{
+			uint16_t flags = 0;
+			if(!first)
+				flags |= WIRE_FLAG_REFINEMENT;
+			if(!last)
+				flags |= WIRE_FLAG_PARTIAL;
+			first = false;
+
+			MessagePtr msg = slave->create_message(image_length + slave_buffer_img_offset);
+			write_tile_prefix(*msg, scene, frame_id, samples, 
+				received_time, rendering_start, rendering_end, flags);
+			std::memcpy(msg->body() + slave_buffer_img_offset, img, image_length);
+
+			if(connection_id == slave->get_connection_id())
+				send_tile(msg);
+		},
+		[connection_id]()
+		{
+			// master moved on
+			boost::lock_guard<boost::mutex> lock(slave_pending_mutex);
+			return !slave_pending_scenes.empty() || connection_id != slave->get_connection_id();
+		});
+}
+
+void slave_render_loop()
+{
+	while(true)
+	{
+		PendingScene pending;
+		{
+			boost::unique_lock<boost::mutex> lock(slave_pending_mutex);
+			while(slave_pending_scenes.empty()) {
+				slave_pending_cond.wait(lock);
+			}
+			pending = slave_pending_scenes.front();
+			slave_pending_scenes.pop_front();
+		}
+
+		if(pending.progressive) {
+			slave_render_progressive(pending.scene, pending.frame_id, pending.connection_id,
+				pending.received_time);
+		} else {
+			slave_render(pending.scene, pending.frame_id, pending.connection_id,
+				pending.received_time);
+		}
+	}
+}
+
+void local_render_loop()
+{
+	SlaveInfo& si = slaves_info[local_worker];
+
+	while(true)
+	{
+		LocalJob job;
+		{
+			boost::unique_lock<boost::mutex> lock(local_jobs_mutex);
+			while(local_jobs.empty()) {
+				local_jobs_cond.wait(lock);
+			}
+			job = local_jobs.front();
+			local_jobs.pop_front();
+		}
+
+		SplitMode split = get_split_mode();
+
+		// a frame of the sequence is ours alone
+		if(split == SPLIT_FRAMES) {
+			double rendering_start = CycleTimer::currentSeconds();
+			render_scene(job.scene, job.frame);
+			record_response(si, CycleTimer::currentSeconds() - rendering_start, nullptr);
+			deliver_whole_frame(si, job.frame);
+			slave_busy[local_worker].store(false, std::memory_order_release);
+			continue;
+		}
+
+		// like a slave, we render into our own buffer and claim the strip
+		// once done, so a slave backing up a slow local strip can still 
+		// deliver it first (see speculate_stragglers)
+
+		// the preview goes into the frame like a slave's, the 
+		// refinements follow until we are given something new
+		if(is_progressive()) {
+			static std::vector<unsigned char> pass_img, blend_img;
+			static std::vector<float> accum;
+			unsigned int frame_id = si.job_frame;
+			int y0 = job.scene.y0;
+			int height = job.scene.render_height;
+			bool first = true;
+			bool lost = false;
+
+			render_progressive(job.scene, pass_img, blend_img, accum,
+				[&](const unsigned char* img, int samples, double rendering_start, double rendering_end, bool last)
+				{
+					if(!first) {
+						deliver_refinement(local_worker, frame_id, y0, height, img, last);
+						return;
+					}
+					first = false;
+
+					record_response(si, rendering_end - rendering_start, nullptr);
+					if(!deliver_tile(si, img)) {
+						lost = true;
+						si.wasted_jobs++;
+						si.wasted_rendering_time += si.rendering_latency;
+						wasted_jobs++;
+						slave_busy[local_worker].store(false, std::memory_order_release);
+						return;
+					}
+					if(!last)
+						start_refinement(local_worker, frame_id, job.frame, y0, height);
+					slave_busy[local_worker].store(false, std::memory_order_release);
+					if(strip_map)
+						strip_map->add(y0, height, local_worker, si.host, si.rendering_latency);
+					add_frame_work(height * job.scene.sample_count);
+				},
+				[&lost]()
+				{
+					if(lost)
+						return true;
+					boost::lock_guard<boost::mutex> lock(local_jobs_mutex);
+					return !local_jobs.empty();
+				});
+			continue;
+		}
+
+		// rows are copied into the frame, samples added up from our buffer
+		static std::vector<unsigned char> strip_img;
+		unsigned char* img = job.frame;
+		if(split == SPLIT_ROWS) {
+			strip_img.resize(job.scene.render_height * WIDTH * PIXEL_SIZE);
+			img = strip_img.data();
+		}
+
+		double rendering_start = CycleTimer::currentSeconds();
+		render_scene(job.scene, img);
+		double rendering_latency = CycleTimer::currentSeconds() - rendering_start;
+
+		record_response(si, rendering_latency, nullptr);
+		if(!deliver_tile(si, img)) {
+			si.wasted_jobs++;
+			si.wasted_rendering_time += rendering_latency;
+			wasted_jobs++;
+			slave_busy[local_worker].store(false, std::memory_order_release);
+			continue;
+		}
+		slave_busy[local_worker].store(false, std::memory_order_release);
+		if(strip_map && split == SPLIT_ROWS)
+			strip_map->add(job.scene.y0, job.scene.render_height, local_worker, si.host, rendering_latency);
+		add_frame_work(job.scene.render_height * job.scene.sample_count);
+	}
+}
+
+// renders for the clients of a local socket until the process ends
+static int run_render_service(const Options& opt)
+{
+	// the benchmark picking the backend renders this table
+	poolScene.initialize();
+	poolScene.camera.position = Vector3(0, 25, 0);
+	poolScene.camera.orientation = Quaternion (0.717, -0.717, 0, 0);
+
+	init_cuda();
+	simdInitialize();
+	pick_backend();
+
+	RenderService service(opt.serve_path, render_scene);
+	return service.run() ? 0 : 1;
+}
+
+// an offline benchmark renders this many frames when not told
+static const int offline_bench_default_frames = 100;
+// and turns the camera this much around the table over them, in radians
+static const double offline_bench_camera_turn = 1.5707963;
+
+// the rays the backend in use cast in its last render
+static RayStats last_ray_stats(const CudaScene& scene)
+{
+	if (mode == 1)
+		return simdRayStats();
+	if (mode == 2)
+		return singleRayStats();
+
+	// the cuda kernel doesn't count its shadow rays
+	RayStats stats;
+	stats.primary_rays = (unsigned long long)WIDTH * scene.render_height * scene.sample_count;
+	stats.shadow_rays = 0;
+	return stats;
+}
+
+// renders the benchmark's frames once more, with the tiles timed, and
+// writes what they cost next to the last frame. Not one of the runs
+// timed, timing the tiles slows the frames down a little
+static int write_offline_tile_stats(const Options& opt, std::vector<CudaScene>& scenes)
 {
-	srand(time(NULL));
+	// the cuda backend renders on the gpu, the tiles of its frames can't be timed
+	if (mode == 0) {
+		std::cout<<"tile stats need a cpu backend, simd or single"<<std::endl;
+		return 1;
+	}
+
+	TileStats stats;
+	std::vector<unsigned char> img(WIDTH * HEIGHT * PIXEL_SIZE);
+	simdTileStats(&stats);
+	singleTileStats(&stats);
+	for(CudaScene& scene : scenes) {
+		render_scene(scene, img.data());
+	}
+	simdTileStats(nullptr);
+	singleTileStats(nullptr);
+
+	std::string prefix = opt.tiles_output;
+	if (!stats.write_csv(prefix + "tiles.csv") || !stats.write_heatmap(prefix + "tiles.ppm")
+		|| !write_ppm((prefix + "frame.ppm").c_str(), img.data())) {
+		std::cout<<"can't write tile stats to "<<prefix<<std::endl;
+		return 1;
+	}
+	return 0;
+}
+
+// renders the same break, seen from the same turning camera, as 
+// fast as the backend can, once for every thread count, and writes 
+// the frame times and rays per second of each
+static int run_offline_bench(const Options& opt)
+{
+	int frames = opt.bench_frames > 0 ? opt.bench_frames : offline_bench_default_frames;
+
+	poolScene.initialize();
+	poolScene.camera.position = Vector3(0, 25, 0);
+	Quaternion camera_orientation(0.717, -0.717, 0, 0);
+	poolScene.camera.orientation = camera_orientation;
+	poolScene.balls[0].velocity += Vector3(0.0, 0.0, 10.0);
 
+	init_cuda();
+	simdInitialize();
+	pick_backend();
+
+	// the break is replayed with the sequence's time step, so
+	// every run renders the very same frames
+	std::vector<CudaScene> scenes;
+	for(int k=0;k<frames;k++)
+	{
+		double angle = offline_bench_camera_turn * k / frames;
+		poolScene.camera.orientation = Quaternion(Vector3::UnitY(), angle) * camera_orientation;
+		poolScene.update(sequence_frame_time);
+
+		CudaScene scene;
+		poolScene.toCudaScene(scene);
+		scene.y0 = 0;
+		scene.render_height = HEIGHT;
+		scene.sample0 = 0;
+		scene.sample_count = NSAMPLES * NSAMPLES;
+		scenes.push_back(scene);
+	}
+
+	// only the simd backend has threads to scale
+	std::vector<int> threads = opt.bench_threads;
+	if (mode != 1) {
+		threads.assign(1, mode == 2 ? 1 : 0);
+	} else if (threads.empty()) {
+		int max_threads = simdMaxThreads();
+		for(int t = 1; t < max_threads; t *= 2) {
+			threads.push_back(t);
+		}
+		threads.push_back(max_threads);
+	}
+
+	std::vector<unsigned char> img(WIDTH * HEIGHT * PIXEL_SIZE);
+	ScalingReport report;
+
+	for(int t : threads)
+	{
+		if (mode == 1)
+			simdSetThreads(t);
+
+		// the first frame only warms up the caches and the threads
+		render_scene(scenes[0], img.data());
+
+		report.start_run(t);
+		for(CudaScene& scene : scenes)
+		{
+			double start = CycleTimer::currentSeconds();
+			render_scene(scene, img.data());
+			double duration = CycleTimer::currentSeconds() - start;
+			report.add_frame(duration, last_ray_stats(scene));
+		}
+		std::cout<<"benchmarked "<<frames<<" frames with "<<t<<" threads"<<std::endl;
+	}
+
+	char host[32];
+	get_host_name(host, sizeof(host));
+	if (!report.write_json(opt.bench_report, host, mode_names[mode], mode != 0)) {
+		std::cout<<"can't write benchmark report "<<opt.bench_report<<std::endl;
+		return 1;
+	}
+
+	if (!opt.tiles_output.empty())
+		return write_offline_tile_stats(opt, scenes);
+	return 0;
+}
+
+int main( int argc, char* argv[] )
+{
 	Options opt;
 	opt.master = false;
 	opt.slave = false;
@@ -512,6 +2686,22 @@ int main( int argc, char* argv[] )
 		return 1;
 	}
 
+	// a benchmark replays the same scene every run
+	if (opt.bench_frames > 0 || opt.offline_bench) {
+		srand(0);
+		random_seed(0);
+	} else {
+		srand(time(NULL));
+	}
+
+	// nothing to show and no frames of our own
+	if (!opt.serve_path.empty()) {
+		return run_render_service(opt);
+	}
+	if (opt.offline_bench) {
+		return run_offline_bench(opt);
+	}
+
 	RaytracerApplication app( opt );
 	s_app = &app;
 	cout << "master:slave => " << opt.master << ":" << opt.slave << endl;
@@ -523,8 +2713,17 @@ int main( int argc, char* argv[] )
 		title = "DRACUDA - Master";
 	}else if(opt.slave) {
 		title = "DRACUDA - Slave";
+	}else if(opt.relay) {
+		title = "DRACUDA - Relay";
+	}
+	bool show_window = !opt.slave && !opt.relay && !opt.headless;
+
+	// a benchmark runs the update loop as fast as frames come back,
+	// a relay as fast as its master's jobs do, and a sequence as fast
+	// as the slaves get through it
+	if (opt.bench_frames > 0 || opt.relay || opt.split == SPLIT_FRAMES) {
+		fps = 1000.0;
 	}
-	bool show_window = !opt.slave;
 
 	ret = Application::start_application(&app, WIDTH, HEIGHT, fps, title, show_window);
 
@@ -1,14 +1,22 @@
 #include <boost/thread/thread.hpp>
+#include <algorithm>
+#include <array>
 #include "master.hpp"
 
 int Master::read_msg_max_length = 800*600*3;
 int Master::write_msg_max_length = 1000;
 int Master::max_concurrent_conn = 1;
+int Master::read_msg_prefix_length = 0;
+int Master::max_connections = 20;
+int Master::msg_pool_size = 40;
+int Master::port = 50000;
+
+static const int small_msg_max_length = 256;
 
 Connection::Connection(boost::asio::ip::tcp::socket socket_, 
 	Master& master_)
 	: socket(std::move(socket_)), read_msg(Master::read_msg_max_length), 
-	  master(master_), strand(socket.get_io_service())
+	  master(master_), strand(socket.get_io_service()), closed(false)
 {}
 
 void Connection::start()
@@ -25,9 +33,8 @@ void Connection::start()
 
 void Connection::send(const unsigned char* chars, int size)
 {
-	MessagePtr msg = std::make_shared<Message>(size);
+	MessagePtr msg = master.create_message(size);
 
-	msg->set_body_length(size);
 	std::memcpy(msg->body(), chars, size);
 	msg->encode_header();
 	send(msg);
@@ -35,9 +42,8 @@ void Connection::send(const unsigned char* chars, int size)
 
 void Connection::send(const std::string& str)
 {
-	MessagePtr msg = std::make_shared<Message>(str.length());
+	MessagePtr msg = master.create_message(str.length());
 
-	msg->set_body_length(str.length());
 	std::memcpy(msg->body(), str.c_str(), str.length());
 	msg->encode_header();
 	send(msg);
@@ -45,12 +51,46 @@ void Connection::send(const std::string& str)
 
 void Connection::send(MessagePtr msg)
 {
-	bool write_in_progress = !write_msgs.empty();
-	write_msgs.push_back(msg);
-	if (!write_in_progress)
+	// the write queue is only touched from the strand
+	auto self(shared_from_this());
+	strand.post(
+	[this, self, msg]()
 	{
-		do_write();
-	}
+		if(closed)
+			return;
+
+		bool write_in_progress = !write_msgs.empty();
+		write_msgs.push_back(msg);
+		if (!write_in_progress)
+		{
+			do_write();
+		}
+	});
+}
+
+void Connection::stop()
+{
+	auto self(shared_from_this());
+	strand.post(
+	[this, self]()
+	{
+		close(boost::asio::error::operation_aborted);
+	});
+}
+
+void Connection::close(const boost::system::error_code& ec)
+{
+	if(closed)
+		return;
+
+	std::cout<<"connection "<<idx<<" closed "<<ec<<std::endl;
+
+	closed = true;
+	write_msgs.clear();
+	boost::system::error_code ignored;
+	socket.close(ignored);
+
+	master.remove_connection(*this);
 }
 
 void Connection::do_write()
@@ -61,10 +101,13 @@ void Connection::do_write()
 	boost::asio::async_write(socket,
 		boost::asio::buffer(write_msgs.front()->data(),
 		write_msgs.front()->length()),
+		strand.wrap(
 		[this, self](boost::system::error_code ec, std::size_t /*length*/)
 		{
 			if (!ec)
 			{
+				// the message goes back to its pool once 
+				// every connection it was queued to has sent it
 				write_msgs.pop_front();
 				if (!write_msgs.empty())
 				{
@@ -73,9 +116,10 @@ void Connection::do_write()
 			}
 			else
 			{
-				//something is wrong
+				close(ec);
 			}
-		});
+		})
+	);
 }
 
 void Connection::do_read_header()
@@ -89,28 +133,126 @@ void Connection::do_read_header()
 		strand.wrap(
 		[this, self](boost::system::error_code ec, std::size_t /*length*/)
 		{
-			if (!ec && read_msg.decode_header())
+			int header = 0;
+			std::memcpy(&header, read_msg.data(), sizeof(header));
+
+			if (!ec && (header & ShmRing::header_flag))
+			{
+				do_read_shm(header);
+			}
+			else if (!ec && read_msg.decode_header())
 			{
 				do_read_body();
 			}
 			else
 			{
-				// something is wrong
-				std::cout<<"something is wrong "<<ec<<std::endl;
+				close(ec);
 			}
 		})
 	);
 }
 
+void Connection::do_read_shm(int header)
+{
+	auto self(shared_from_this());
+
+	if(header == ShmRing::attach_header)
+	{
+		// the slave's pid follows
+		boost::asio::async_read(socket,
+			boost::asio::buffer(read_msg.body(), sizeof(int)),
+			strand.wrap(
+			[this, self](boost::system::error_code ec, std::size_t /*length*/)
+			{
+				if (!ec)
+				{
+					int pid = 0;
+					std::memcpy(&pid, read_msg.body(), sizeof(pid));
+					attach_shm(pid);
+					do_read_header();
+				}
+				else
+				{
+					close(ec);
+				}
+			})
+		);
+		return;
+	}
+
+	if(read_shm_slot(header & ~ShmRing::header_flag)) {
+		do_read_header();
+	} else {
+		close(boost::asio::error::invalid_argument);
+	}
+}
+
+void Connection::attach_shm(int pid)
+{
+	shm_ring.reset(ShmRing::open(ShmRing::name_for(pid)));
+	if(!shm_ring) {
+		// the slave keeps sending everything over the socket
+		std::cout<<"can't attach to shared memory of slave "<<idx<<std::endl;
+		return;
+	}
+
+	std::cout<<"slave "<<idx<<" sends through shared memory"<<std::endl;
+
+	MessagePtr ack = master.create_message(0);
+	int header = ShmRing::attach_header;
+	std::memcpy(ack->data(), &header, sizeof(header));
+	send(ack);
+}
+
+bool Connection::read_shm_slot(int slot)
+{
+	if(!shm_ring || slot < 0 || slot >= shm_ring->get_slot_count())
+		return false;
+
+	const char* data = shm_ring->get_slot_data(slot);
+	int body_length = 0;
+	std::memcpy(&body_length, data, sizeof(body_length));
+	if(body_length < 0 || body_length > shm_ring->get_slot_body_length() 
+		|| body_length > read_msg.max_body_length)
+		return false;
+
+	const char* body = data + Message::header_length;
+	int prefix_length = std::min(Master::read_msg_prefix_length, body_length);
+	int payload_length = body_length - prefix_length;
+	unsigned char* payload = nullptr;
+
+	std::memcpy(read_msg.body(), body, prefix_length);
+	read_msg.set_body_length(prefix_length);
+
+	if(master.on_payload_destination && prefix_length > 0 && payload_length > 0)
+	{
+		payload = master.on_payload_destination(this->idx, read_msg, payload_length);
+	}
+
+	// the same single copy a direct read would do, minus the socket
+	if(payload)
+	{
+		std::memcpy(payload, body + prefix_length, payload_length);
+	}
+	else
+	{
+		std::memcpy(read_msg.body() + prefix_length, body + prefix_length, payload_length);
+		read_msg.set_body_length(body_length);
+	}
+
+	// the slave can reuse the slot
+	shm_ring->set_slot_in_use(slot, false);
+
+	master.on_message_received(this->idx, read_msg);
+	return true;
+}
+
 void Connection::do_read_body()
 {
 	// std::cout<<"trying to call read body"<<std::endl;
 	auto self(shared_from_this());
 
-	boost::asio::async_read(socket,
-		boost::asio::buffer(read_msg.body(), read_msg.body_length()),
-		
-		strand.wrap(
+	auto on_body_read = 
 		[this, self](boost::system::error_code ec, std::size_t /*length*/)
 		{
 			if (!ec)
@@ -123,16 +265,62 @@ void Connection::do_read_body()
 			}
 			else
 			{
-				// something is wrong
-				std::cout<<"something is wrong "<<ec<<std::endl;
+				close(ec);
+			}
+		};
+
+	int body_length = read_msg.body_length();
+	int prefix_length = std::min(Master::read_msg_prefix_length, body_length);
+	int payload_length = body_length - prefix_length;
+
+	if(!master.on_payload_destination || prefix_length == 0 || payload_length == 0)
+	{
+		boost::asio::async_read(socket,
+			boost::asio::buffer(read_msg.body(), body_length),
+			strand.wrap(on_body_read));
+		return;
+	}
+
+	// the prefix tells where the payload goes, read it first
+	boost::asio::async_read(socket,
+		boost::asio::buffer(read_msg.body(), prefix_length),
+		strand.wrap(
+		[this, self, on_body_read, body_length, prefix_length, payload_length]
+		(boost::system::error_code ec, std::size_t /*length*/)
+		{
+			if (ec)
+			{
+				close(ec);
+				return;
+			}
+
+			read_msg.set_body_length(prefix_length);
+			unsigned char* payload = master.on_payload_destination(this->idx, read_msg, payload_length);
+
+			if(payload)
+			{
+				// the payload lands directly at its destination without 
+				// any extra copy, the message only holds the prefix
+				boost::asio::async_read(socket,
+					boost::asio::buffer(payload, payload_length),
+					strand.wrap(on_body_read));
+			}
+			else
+			{
+				read_msg.set_body_length(body_length);
+				boost::asio::async_read(socket,
+					boost::asio::buffer(read_msg.body() + prefix_length, payload_length),
+					strand.wrap(on_body_read));
 			}
 		})
 	);
 }
 
 Master::Master(boost::asio::io_service& io_service)
-	: acceptor(io_service, tcp::endpoint(tcp::v4(), 50000)),
-	socket(io_service), scene_write_msg(new Message(Master::write_msg_max_length))
+	: acceptor(io_service, tcp::endpoint(tcp::v4(), Master::port)),
+	socket(io_service), 
+	small_msg_pool(small_msg_max_length, Master::msg_pool_size),
+	scene_msg_pool(Master::write_msg_max_length, Master::msg_pool_size)
 {
 	connections.reserve(4);
 
@@ -166,10 +354,29 @@ void Master::do_accept()
 			if (!ec)
 			{
 				auto conn_ptr = std::make_shared<Connection>(std::move(socket), *this);
-				conn_ptr->idx = this->connections.size();
-				this->connections.push_back(conn_ptr);
+				bool accepted = true;
+				{
+					std::lock_guard<std::mutex> lock(connections_mutex);
+
+					// reuse the slot of a closed connection first
+					auto slot = std::find(connections.begin(), connections.end(), nullptr);
+					if(slot != connections.end()) {
+						conn_ptr->idx = slot - connections.begin();
+						*slot = conn_ptr;
+					}else if((int)connections.size() < max_connections) {
+						conn_ptr->idx = this->connections.size();
+						this->connections.push_back(conn_ptr);
+					}else{
+						accepted = false;
+					}
+				}
 
-				conn_ptr->start();
+				if(accepted) {
+					conn_ptr->start();
+				}else{
+					// dropping conn_ptr closes the socket
+					std::cout<<"refusing connection, already "<<max_connections<<" connected"<<std::endl;
+				}
 			}
 
 			do_accept();
@@ -178,9 +385,8 @@ void Master::do_accept()
 
 void Master::send_all(const std::string& str)
 {
-	MessagePtr msg = std::make_shared<Message>(str.length());
+	MessagePtr msg = create_message(str.length());
 
-	msg->set_body_length(str.length());
 	std::memcpy(msg->body(), str.c_str(), str.length());
 	msg->encode_header();
 	send_all(msg);	
@@ -188,21 +394,79 @@ void Master::send_all(const std::string& str)
 
 void Master::send_all(MessagePtr msg)
 {
-	for (auto connection: connections) {
-		connection->send(msg);
+	std::vector<ConnectionPtr> conns;
+	{
+		std::lock_guard<std::mutex> lock(connections_mutex);
+		conns = connections;
+	}
+
+	for (auto connection: conns) {
+		if(connection)
+			connection->send(msg);
 	}
 }
 
 void Master::send(int conn_idx, MessagePtr msg)
 {
-	connections[conn_idx]->send(msg);
+	ConnectionPtr conn;
+	{
+		std::lock_guard<std::mutex> lock(connections_mutex);
+		conn = connections[conn_idx];
+	}
+
+	// the slave might have left
+	if(conn)
+		conn->send(msg);
+}
+
+void Master::close_connection(int conn_idx)
+{
+	ConnectionPtr conn;
+	{
+		std::lock_guard<std::mutex> lock(connections_mutex);
+		conn = connections[conn_idx];
+	}
+
+	if(conn)
+		conn->stop();
+}
+
+void Master::remove_connection(Connection& conn)
+{
+	{
+		std::lock_guard<std::mutex> lock(connections_mutex);
+		if(connections[conn.idx].get() != &conn)
+			return;
+		connections[conn.idx].reset();
+	}
+
+	if(on_connection_closed)
+	{
+		on_connection_closed(conn.idx);
+	}
 }
 
 int Master::get_connections_count() const
 {
+	std::lock_guard<std::mutex> lock(connections_mutex);
 	return connections.size();
 }
 
+MessagePtr Master::create_message(int body_length)
+{
+	MessagePtr msg = small_msg_pool.acquire(body_length);
+	if(!msg)
+		msg = scene_msg_pool.acquire(body_length);
+
+	// too big for any size class
+	if(!msg) {
+		msg = new Message(body_length);
+		msg->set_body_length(body_length);
+	}
+
+	return msg;
+}
+
 void Master::set_on_message_received(std::function<void(int conn_idx, const Message& message)> const& cb)
 {
 	on_message_received = cb;
@@ -213,6 +477,16 @@ void Master::set_on_connection_started(std::function<void(Connection& connection
 	on_connection_started = cb;
 }
 
+void Master::set_on_connection_closed(std::function<void(int conn_idx)> const& cb)
+{
+	on_connection_closed = cb;
+}
+
+void Master::set_on_payload_destination(std::function<unsigned char*(int conn_idx, const Message& prefix, int payload_length)> const& cb)
+{
+	on_payload_destination = cb;
+}
+
 struct Test {
 	char a;
 	char b;
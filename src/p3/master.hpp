@@ -6,9 +6,13 @@
 #include <boost/enable_shared_from_this.hpp>
 #include <deque>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <vector>
 
 #include "message.hpp"
+#include "message_pool.hpp"
+#include "shm_ring.hpp"
 
 class Master;
 
@@ -25,18 +29,14 @@ public:
 	void start();
 
 	template<typename T>
-	void send(const T& value) {
-		MessagePtr msg =  std::make_shared<Message>(sizeof(T));
-
-		msg->set_body_length(sizeof(T));
-		std::memcpy(msg->body(), &value, sizeof(T));
-		msg->encode_header();
-		send(msg);
-	}
+	void send(const T& value);
 
 	void send(const unsigned char*, int size);
 	void send(const std::string& str);
-	void send(MessagePtr msg); // connection will responsible for t
+	void send(MessagePtr msg); // safe to call from any thread
+
+	// closes the connection, safe to call from any thread
+	void stop();
 
 	int idx;
 
@@ -46,9 +46,24 @@ private:
 	void do_read_body();
 	void do_write();
 
+	// a header carrying ShmRing::header_flag : the slave attaching its
+	// shared memory, or the doorbell of a message waiting in one of its slots
+	void do_read_shm(int header);
+	void attach_shm(int pid);
+	// delivers the message in the slot like one read from the socket.
+	// Returns false if the slot is not valid
+	bool read_shm_slot(int slot);
+
+	// closes the socket and frees the connection's slot in master.
+	// must run on the strand
+	void close(const boost::system::error_code& ec);
+	bool closed;
+
 	tcp::socket socket;
 	Message read_msg;
 	MessageQueue write_msgs;
+	// slave's slots, if it runs on the same host
+	std::unique_ptr<ShmRing> shm_ring;
 	boost::asio::strand strand;
 	Master& master;
 };
@@ -69,13 +84,27 @@ public:
 	static int write_msg_max_length;
 	static int max_concurrent_conn;
 
+	// number of bytes at the front of a message body that are always
+	// read into the message first. The rest of the body (the payload) 
+	// can be read directly into a destination given by on_payload_destination
+	static int read_msg_prefix_length;
+
+	// connections beyond this are refused. Slots of closed
+	// connections are reused by new ones
+	static int max_connections;
+
+	// number of preallocated messages per size class
+	static int msg_pool_size;
+
+	// port slaves connect to
+	static int port;
+
 	static Master& start();	
 
 	template<typename T>
 	void send_all(const T& value) {
-		MessagePtr msg =  std::make_shared<Message>(sizeof(T));
+		MessagePtr msg = create_message(sizeof(T));
 
-		msg->set_body_length(sizeof(T));
 		std::memcpy(msg->body(), &value, sizeof(T));
 		msg->encode_header();
 		send_all(msg);	
@@ -86,23 +115,36 @@ public:
 
 	template<typename T>
 	void send(int conn_idx, const T& value) {
-		// hack
+		MessagePtr msg = create_message(sizeof(T));
 
-		// MessagePtr msg =  std::make_shared<Message>(sizeof(T));
-		MessagePtr msg = scene_write_msg;
-
-		msg->set_body_length(sizeof(T));
 		std::memcpy(msg->body(), &value, sizeof(T));
 		msg->encode_header();
 		send(conn_idx, msg);			
 	}
 	void send(int conn_idx, MessagePtr msg);
 
+	// drops the connection, on_connection_closed follows
+	void close_connection(int conn_idx);
+
+	// number of connection slots, some of them may be closed
 	int get_connections_count() const;
 
+	// returns a message with the given body length, taken from
+	// the pool of its size class when there is one
+	MessagePtr create_message(int body_length);
+
 	// callbacks
 	void set_on_message_received(std::function<void(int conn_idx, const Message&)> const& cb);
 	void set_on_connection_started(std::function<void(Connection&)> const& cb);
+	void set_on_connection_closed(std::function<void(int conn_idx)> const& cb);
+
+	// called once the prefix of a message is read (see read_msg_prefix_length),
+	// before reading the rest of its body. The message given holds the prefix.
+	// Returning a pointer makes the connection read the payload straight
+	// into it, in that case the message given to on_message_received 
+	// only holds the prefix.
+	// Returning nullptr reads the whole body into the message as usual
+	void set_on_payload_destination(std::function<unsigned char*(int conn_idx, const Message& prefix, int payload_length)> const& cb);
 
 private:
 
@@ -115,13 +157,30 @@ private:
 	// callbacks
 	std::function<void(int conn_idx, const Message&)> on_message_received;
 	std::function<void(Connection&)> on_connection_started;
+	std::function<void(int conn_idx)> on_connection_closed;
+	std::function<unsigned char*(int conn_idx, const Message& prefix, int payload_length)> on_payload_destination;
 
 	void do_accept();
+	void remove_connection(Connection& conn);
 
 	tcp::acceptor acceptor;
 	tcp::socket socket;
 
-	MessagePtr scene_write_msg; // hack
+	// size classes of the messages master sends
+	MessagePool small_msg_pool;
+	MessagePool scene_msg_pool;
 
+	// accepted on the io threads, used from the update thread.
+	// a closed connection leaves a null slot
 	std::vector<ConnectionPtr> connections;
+	mutable std::mutex connections_mutex;
 };
+
+template<typename T>
+void Connection::send(const T& value) {
+	MessagePtr msg = master.create_message(sizeof(T));
+
+	std::memcpy(msg->body(), &value, sizeof(T));
+	msg->encode_header();
+	send(msg);
+}
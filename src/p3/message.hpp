@@ -1,6 +1,22 @@
 #pragma once
 
+#include <atomic>
+#include <cstring>
 #include <iostream>
+#include <boost/intrusive_ptr.hpp>
+
+class Message;
+
+// where a message goes back to once nobody references it anymore
+// (see MessagePool)
+class MessageRecycler
+{
+public:
+	virtual void recycle(Message* msg) = 0;
+
+protected:
+	~MessageRecycler() {}
+};
 
 class Message
 {
@@ -11,17 +27,27 @@ public:
 
 	// constructor
 	Message(int max_body_length) 
-		: body_length_(0), max_body_length(max_body_length)
+		: body_length_(0), max_body_length(max_body_length),
+		  ref_count(0), recycler(nullptr), owns_data(true), shm_slot_(-1)
 	{
 		// std::cout<<"Message::Message()"<<std::endl;
 		data_ = new char[header_length + max_body_length];
 	}
 
+	// a message over memory owned by someone else, 
+	// the slot shm_slot of a ShmRing
+	Message(char* data, int max_body_length, int shm_slot) 
+		: data_(data), body_length_(0), max_body_length(max_body_length),
+		  ref_count(0), recycler(nullptr), owns_data(false), shm_slot_(shm_slot)
+	{
+	}
+
 	// destructor
 	~Message()
 	{
 		// std::cout<<"Message::~Message()"<<std::endl;
-		delete[] data_;
+		if(owns_data)
+			delete[] data_;
 	}
 
 	// copy constructor
@@ -79,6 +105,12 @@ public:
 		std::memcpy(data_, &body_length_, sizeof(body_length_));
 	}
 
+	// slot of the ShmRing the message lives in, -1 if none
+	inline int shm_slot() const
+	{
+		return shm_slot_;
+	}
+
 	inline void set_body_length(int val)
 	{
 		body_length_ = val;
@@ -87,11 +119,41 @@ public:
 	}
 
 
-
-	
 private:
+	friend class MessagePool;
+	friend class ShmMessagePool;
+	friend void intrusive_ptr_add_ref(Message* msg);
+	friend void intrusive_ptr_release(Message* msg);
+
 	char* data_;
 	int body_length_;
+
+	// number of MessagePtr referencing this message
+	std::atomic<int> ref_count;
+
+	// nullptr if the message is not pooled, it is deleted instead
+	MessageRecycler* recycler;
+
+	bool owns_data;
+	int shm_slot_;
 };	
 
-typedef std::shared_ptr<Message> MessagePtr;
\ No newline at end of file
+inline void intrusive_ptr_add_ref(Message* msg)
+{
+	msg->ref_count.fetch_add(1, std::memory_order_relaxed);
+}
+
+inline void intrusive_ptr_release(Message* msg)
+{
+	if(msg->ref_count.fetch_sub(1, std::memory_order_acq_rel) == 1)
+	{
+		if(msg->recycler)
+			msg->recycler->recycle(msg);
+		else
+			delete msg;
+	}
+}
+
+// reference counted message. A message queued to several connections
+// is shared, and goes back to its pool after the last write completes
+typedef boost::intrusive_ptr<Message> MessagePtr;
\ No newline at end of file
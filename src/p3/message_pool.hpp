@@ -0,0 +1,83 @@
+#pragma once
+
+#include <mutex>
+#include <vector>
+
+#include "message.hpp"
+
+// A pool of preallocated messages of one size class.
+// Messages handed out by acquire() come back to the pool when their
+// last MessagePtr is released (typically when the async write that
+// sent it completes), so sending doesn't allocate in steady state.
+// If every message is in flight the pool grows by one message.
+class MessagePool : public MessageRecycler
+{
+public:
+
+	MessagePool(int max_body_length, int count)
+		: max_body_length(max_body_length)
+	{
+		free_messages.reserve(count);
+		for(int i=0;i<count;i++)
+		{
+			free_messages.push_back(create_message());
+		}
+	}
+
+	~MessagePool()
+	{
+		for(auto msg : free_messages) {
+			delete msg;
+		}
+	}
+
+	// returns nullptr if body_length doesn't fit in this size class
+	MessagePtr acquire(int body_length)
+	{
+		if(body_length > max_body_length)
+			return MessagePtr();
+
+		Message* msg = nullptr;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if(!free_messages.empty()) {
+				msg = free_messages.back();
+				free_messages.pop_back();
+			}
+		}
+
+		if(!msg)
+			msg = create_message();
+
+		msg->set_body_length(body_length);
+		return MessagePtr(msg);
+	}
+
+	virtual void recycle(Message* msg)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		free_messages.push_back(msg);
+	}
+
+	int get_max_body_length() const
+	{
+		return max_body_length;
+	}
+
+private:
+
+	// prevent from copying
+	MessagePool(MessagePool const& other) = delete;
+	void operator=(MessagePool const& other) = delete;
+
+	Message* create_message()
+	{
+		Message* msg = new Message(max_body_length);
+		msg->recycler = this;
+		return msg;
+	}
+
+	const int max_body_length;
+	std::vector<Message*> free_messages;
+	std::mutex mutex;
+};
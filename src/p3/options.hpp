@@ -1,15 +1,91 @@
 #pragma once
 
 #include <string>
+#include <vector>
+
+// how master divides the work among its slaves
+enum SplitMode
+{
+	// each slave renders a strip of rows of every frame
+	SPLIT_ROWS,
+	// each slave renders every pixel of a frame with
+	// a part of its samples, master adds them up
+	SPLIT_SAMPLES,
+	// a recorded sequence of frames, each slave renders
+	// whole frames of it at its own pace
+	SPLIT_FRAMES
+};
+
+// a table served by a multi-session master
+struct SessionOptions
+{
+	// frames per second it asks for
+	double fps;
+	// its share of the slaves when they can't keep up
+	double weight;
+};
 
 struct Options
 {
 	bool master;
 	bool slave;
-	// for master:
+	// a relay is a master to its own slaves and a single
+	// slave to its master, see the relay part of main.cpp
+	bool relay = false;
+	// for master and relay:
 	int min_slave_to_start = 0;
+	// port our slaves connect to
+	int listen_port = 50000;
+	// where what was learnt about the slaves is kept 
+	// between runs (see SlaveHistory), none if empty
+	std::string slave_history = ".dracuda_slaves";
+
+	// for master:
+	// master renders a share of every frame itself
+	bool local_slice = false;
+	SplitMode split = SPLIT_ROWS;
+	// with SPLIT_ROWS, slaves send a preview of their strip
+	// first and refine it until the scene changes
+	bool progressive = false;
+	// with SPLIT_FRAMES, where the frames of the sequence 
+	// (or of the sessions) are written, prefix of the file names.
+	// None if empty
+	std::string frames_output;
+	// several tables, each with its own scene, sharing the slaves.
+	// Their frames go whole to the slaves, as with SPLIT_FRAMES.
+	// The window shows the first one
+	std::vector<SessionOptions> sessions;
 
-	// for slave:
-	// host to connect from slave
+	// for slave and relay:
+	// host and port to connect from slave
 	std::string host;
+	int master_port = 50000;
+
+	// no window, for benchmarks. Slaves never have one
+	bool headless = false;
+
+	// renders the scenes clients send on this local socket, with 
+	// no window and no master or slaves (see RenderService)
+	std::string serve_path;
+
+	// for master:
+	// quits after this many frames and writes 
+	// a benchmark report, 0 runs forever.
+	// With SPLIT_FRAMES, the length of the sequence
+	int bench_frames = 0;
+	// where the report goes, stdout if empty
+	std::string bench_report;
+
+	// renders bench_frames frames of a recorded break on its own, with
+	// no window, master or slaves, once for every thread count, and 
+	// reports how fast (see run_offline_bench in main.cpp)
+	bool offline_bench = false;
+	// the thread counts, powers of two up to the cpus if empty
+	std::vector<int> bench_threads;
+
+	// where what the frame's tiles cost goes, prefix of the file names.
+	// The offline benchmark renders its frames once more to measure
+	// them, see TileStats. A master splitting rows writes which slave
+	// rendered which strip of its last frame, see StripMap. None if empty
+	std::string tiles_output;
 };
\ No newline at end of file
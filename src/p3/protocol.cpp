@@ -0,0 +1,161 @@
+#include "protocol.hpp"
+#include "cudaScene.hpp"
+#include "constants.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+const int scene_payload_length = (SPHERES * 4 + SPHERES * 3 + 4 * 3) * sizeof(float) 
+	+ 2 * sizeof(uint16_t);
+
+// field by field, so the layout of CudaScene doesn't matter
+static char* put(char* out, const float* values, int count)
+{
+	std::memcpy(out, values, count * sizeof(float));
+	return out + count * sizeof(float);
+}
+
+static const char* get(const char* in, float* values, int count)
+{
+	std::memcpy(values, in, count * sizeof(float));
+	return in + count * sizeof(float);
+}
+
+static char* put(char* out, uint16_t value)
+{
+	std::memcpy(out, &value, sizeof(value));
+	return out + sizeof(value);
+}
+
+static const char* get(const char* in, uint16_t& value)
+{
+	std::memcpy(&value, in, sizeof(value));
+	return in + sizeof(value);
+}
+
+static char* put(char* out, const float3& v)
+{
+	float values[3] = { v.x, v.y, v.z };
+	return put(out, values, 3);
+}
+
+static const char* get(const char* in, float3& v)
+{
+	float values[3];
+	in = get(in, values, 3);
+	v = make_float3(values[0], values[1], values[2]);
+	return in;
+}
+
+WireHeader make_wire_header(WireType type, unsigned int frame_id,
+	int y0, int height, int payload_length)
+{
+	WireHeader header;
+	std::memset(&header, 0, sizeof(header));
+	header.type = type;
+	header.codec = CODEC_NONE;
+	header.frame_id = frame_id;
+	header.x0 = 0;
+	header.y0 = y0;
+	header.width = WIDTH;
+	header.height = height;
+	header.payload_length = payload_length;
+	return header;
+}
+
+int write_wire_message(char* body, const WireHeader& header, const char* payload)
+{
+	std::memcpy(body, &header, sizeof(header));
+	if(payload)
+		std::memcpy(body + sizeof(header), payload, header.payload_length);
+	return sizeof(header) + header.payload_length;
+}
+
+bool read_wire_header(const char* body, int body_length, WireHeader& header)
+{
+	if(body_length < (int)sizeof(header))
+		return false;
+
+	std::memcpy(&header, body, sizeof(header));
+	return true;
+}
+
+void encode_scene(const CudaScene& scene, char* payload)
+{
+	for(int i=0;i<SPHERES;i++)
+	{
+		const float4& q = scene.ball_orientation[i];
+		float values[4] = { q.x, q.y, q.z, q.w };
+		payload = put(payload, values, 4);
+	}
+	for(int i=0;i<SPHERES;i++) {
+		payload = put(payload, scene.ball_position[i]);
+	}
+	payload = put(payload, scene.cam_position);
+	payload = put(payload, scene.dir);
+	payload = put(payload, scene.cU);
+	payload = put(payload, scene.ARcR);
+	payload = put(payload, (uint16_t)scene.sample0);
+	payload = put(payload, (uint16_t)scene.sample_count);
+}
+
+void decode_scene(const char* payload, CudaScene& scene)
+{
+	for(int i=0;i<SPHERES;i++)
+	{
+		float values[4];
+		payload = get(payload, values, 4);
+		scene.ball_orientation[i] = make_float4(values[0], values[1], values[2], values[3]);
+	}
+	for(int i=0;i<SPHERES;i++) {
+		payload = get(payload, scene.ball_position[i]);
+	}
+	payload = get(payload, scene.cam_position);
+	payload = get(payload, scene.dir);
+	payload = get(payload, scene.cU);
+	payload = get(payload, scene.ARcR);
+
+	uint16_t sample0, sample_count;
+	payload = get(payload, sample0);
+	payload = get(payload, sample_count);
+	scene.sample0 = sample0;
+	scene.sample_count = sample_count;
+}
+
+bool for_each_wire_message(const char* body, int body_length,
+	const std::function<bool(const WireHeader& header, const char* payload, int available_length)>& fn)
+{
+	WireHeader header;
+	if(!read_wire_header(body, body_length, header))
+		return false;
+
+	const char* payload = body + sizeof(header);
+	int available = body_length - sizeof(header);
+
+	if(header.type != WIRE_BATCH) {
+		fn(header, payload, std::min<int>(available, header.payload_length));
+		return true;
+	}
+
+	// a batch has to be there in full
+	if(header.payload_length > (uint32_t)available)
+		return false;
+
+	int offset = 0;
+	while(offset < (int)header.payload_length)
+	{
+		WireHeader sub;
+		int left = header.payload_length - offset;
+		if(!read_wire_header(payload + offset, left, sub)
+			|| sub.type == WIRE_BATCH
+			|| sub.payload_length > (uint32_t)(left - sizeof(sub)))
+			return false;
+
+		if(!fn(sub, payload + offset + sizeof(sub), sub.payload_length))
+			return true;
+
+		offset += sizeof(sub) + sub.payload_length;
+	}
+
+	return true;
+}
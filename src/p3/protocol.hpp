@@ -0,0 +1,165 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+
+struct CudaScene;
+
+// Wire protocol between master and slave.
+// The body of every Message starts with a WireHeader telling what the
+// message is, which frame and which rows of the image it is about, and
+// how its pixels are encoded. The payload follows it.
+//
+// A slave starts with WIRE_HELLO, carrying the range of protocol versions
+// it speaks and what it renders with. Master answers WIRE_WELCOME with
+// the version to use, or drops the slave if there is none in common.
+// Then master sends WIRE_SCENE jobs and the slave answers WIRE_TILE,
+// or several of them for a progressive scene.
+// Every now and then master sends WIRE_PING, which the slave answers
+// right away with WIRE_PONG. The times in them give the offset between
+// the clocks of master and slave, so the times a slave puts in its
+// tiles can be placed on master's clock.
+// A WIRE_BATCH payload is a sequence of whole messages (header and
+// payload). Only the render service writes batches, several tiles in
+// one answer (see render_service.hpp). Master and slave write one
+// message at a time, but unpack a batch if they get one; a tile inside
+// a batch is copied into the frame instead of read into it.
+//
+// Every field has a fixed size, nothing depends on how a build lays out
+// its structs. Hosts are expected to be little endian.
+
+// 2: scenes and tiles carry the range of samples rendered
+// 3: hello carries the vector width and a benchmark score
+// 4: hello carries the slave's host name
+// 5: tiles carry the slave's timestamps, ping probes. The tile 
+//    prefix grew, so older slaves can't be understood anymore
+static const uint16_t PROTOCOL_VERSION = 5;
+static const uint16_t PROTOCOL_MIN_VERSION = 5;
+
+enum WireType : uint8_t
+{
+	WIRE_HELLO = 1,
+	WIRE_WELCOME = 2,
+	WIRE_SCENE = 3,
+	WIRE_TILE = 4,
+	WIRE_BATCH = 5,
+	WIRE_PING = 6,
+	WIRE_PONG = 7
+};
+
+// WireHeader flags
+// a scene to render progressively: a first tile with a few samples,
+// then tiles of the same rows with more and more samples
+static const uint16_t WIRE_FLAG_PROGRESSIVE = 1;
+// a tile that more refined tiles of the same rows follow
+static const uint16_t WIRE_FLAG_PARTIAL = 2;
+// a tile refining one sent before
+static const uint16_t WIRE_FLAG_REFINEMENT = 4;
+
+// how the pixels of a tile are encoded
+enum WireCodec : uint8_t
+{
+	CODEC_NONE = 0,
+	// PIXEL_SIZE bytes per pixel, rows top to bottom
+	CODEC_RGB8 = 1
+};
+
+#pragma pack(push, 1)
+
+struct WireHeader
+{
+	uint8_t type;
+	uint8_t codec;
+	uint16_t flags;
+	uint32_t frame_id;
+	// the tile, in pixels
+	uint16_t x0;
+	uint16_t y0;
+	uint16_t width;
+	uint16_t height;
+	// bytes following the header
+	uint32_t payload_length;
+};
+
+struct HelloPayload
+{
+	uint16_t min_version;
+	uint16_t max_version;
+	// render mode, 0 cuda, 1 simd, 2 single
+	uint8_t backend;
+	uint8_t reserved;
+	uint16_t hardware_threads;
+
+	// since version 3, zero when sent by an older slave
+	// floats per vector instruction of the slave's cpu
+	uint16_t vector_width;
+	uint16_t reserved2;
+	// rows of a reference scene rendered per second with the backend,
+	// at full samples. 0 if the slave didn't measure it
+	float benchmark_rows_per_second;
+
+	// since version 4, zero terminated
+	char host[32];
+};
+
+// what a version 2 slave sends
+static const int hello_payload_v2_length = 8;
+
+struct WelcomePayload
+{
+	uint16_t version;
+	uint16_t reserved;
+};
+
+// in front of a tile's pixels
+struct TilePrefix
+{
+	double rendering_latency;
+	// samples of each pixel the tile holds, see CudaScene
+	uint16_t sample0;
+	uint16_t sample_count;
+
+	// on the slave's clock, in seconds: when the scene came in, when
+	// rendering started and ended, and when the tile was handed to
+	// the connection to be sent
+	double received_time;
+	double render_start;
+	double render_end;
+	double send_time;
+};
+
+// a ping only has master_send, the pong has all of them.
+// Each on the clock of who wrote it, in seconds
+struct ProbePayload
+{
+	double master_send;
+	double slave_receive;
+	double slave_send;
+};
+
+#pragma pack(pop)
+
+// bytes of an encoded CudaScene, without its row range
+extern const int scene_payload_length;
+
+WireHeader make_wire_header(WireType type, unsigned int frame_id,
+	int y0, int height, int payload_length);
+
+// a header and its payload are written at body,
+// returns the number of bytes written
+int write_wire_message(char* body, const WireHeader& header, const char* payload);
+
+// reads the header at the front of a body, false if there isn't one
+bool read_wire_header(const char* body, int body_length, WireHeader& header);
+
+// scene's camera, balls and sample range, the row range goes in the header
+void encode_scene(const CudaScene& scene, char* payload);
+void decode_scene(const char* payload, CudaScene& scene);
+
+// calls fn for the message in body, or for every message in it if it is a batch.
+// available_length is how much of the payload is in the body, it can be less
+// than header.payload_length for a message whose payload was delivered elsewhere
+// (see Master::set_on_payload_destination). Stops when fn returns false.
+// Returns false if the body is malformed
+bool for_each_wire_message(const char* body, int body_length,
+	const std::function<bool(const WireHeader& header, const char* payload, int available_length)>& fn);
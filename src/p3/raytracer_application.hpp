@@ -10,13 +10,12 @@ class RaytracerApplication : public Application
 {
 public:
     RaytracerApplication( const Options& opt )
-        : options( opt ), cur_frame_number(0) {}
+        : options( opt ), cur_frame_number(0), cur_render_frame_number(0) {}
 
     virtual ~RaytracerApplication() {
-		if (buffer)
-			free( buffer );
-        if(back_buffer)
-            free(back_buffer);
+		// master's buffer belongs to its frame pool
+		if (buffer && !options.master)
+			delete[] buffer;
 	}
 
     virtual bool initialize();
@@ -27,7 +26,9 @@ public:
 	float time;
 
 	void do_gpu_raytracing();
-    void swap_buffer();
+    // displays a completed frame, and returns the frame 
+    // that was displayed before so it can be reused
+    unsigned char* present_frame(unsigned char* frame);
 
     Options options;
     CameraRoamControl camera_control;
@@ -37,5 +38,4 @@ public:
 	unsigned int cur_render_frame_number;
 
     unsigned char* buffer = 0;
-    unsigned char* back_buffer = 0;
 };
@@ -229,12 +229,12 @@ __device__ float3 do_material (int geom, float3 pos)
 
 
 __global__
-void curandSetupKernel()
+void curandSetupKernel(unsigned long long seed)
 {
 	int x = blockIdx.x * blockDim.x + threadIdx.x;
 	int y = blockIdx.y * blockDim.y + threadIdx.y;
 	int w = y * WIDTH + x;
-	curand_init(1578, w, 0, cuConstants.curand + w);
+	curand_init(seed, w, 0, cuConstants.curand + w);
 }
 
 __device__ float sphereIntersectionTestAll(float3 ray_d, float3 ray_e, int &geom)
@@ -300,8 +300,9 @@ void cudaRayTraceKernel (unsigned char *img, int y_start)
 	float3 accumulated_color = make_float3(0.0, 0.0, 0.0);
 
 	// Jittered Sampling
-	for (int sampleX = 0; sampleX < NSAMPLES; sampleX++)
-	for (int sampleY = 0; sampleY < NSAMPLES; sampleY++) {
+	for (int sample = cuScene.sample0; sample < cuScene.sample0 + cuScene.sample_count; sample++) {
+		int sampleX = sample / NSAMPLES;
+		int sampleY = sample % NSAMPLES;
 		float di = (x + (sampleX + curand_uniform(curand)) / NSAMPLES) / WIDTH * 2 - 1;
 		float dj = (y + (sampleY + curand_uniform(curand)) / NSAMPLES) / HEIGHT * 2 - 1;
 		float3 ray_d = normalize(cuScene.dir + dj * cuScene.cU + di * cuScene.ARcR);
@@ -375,7 +376,7 @@ void cudaRayTraceKernel (unsigned char *img, int y_start)
 		}
 	}
 	
-	accumulated_color /= NSAMPLES * NSAMPLES;
+	accumulated_color /= cuScene.sample_count;
 	// using 3 color per pixel
 	uchar3 col0;
 	col0.x = clamp(__powf(accumulated_color.x, 0.50) * 255, 0.0, 255.0);
@@ -386,7 +387,7 @@ void cudaRayTraceKernel (unsigned char *img, int y_start)
 	
 }
 
-void cudaInitialize()
+void cudaInitialize(unsigned int seed)
 {
 	initialize_constants();
 	gpuErrchk(cudaMalloc((void **)&cudaBuffer, PIXEL_SIZE * HEIGHT * WIDTH));
@@ -394,7 +395,7 @@ void cudaInitialize()
 	gpuErrchk(cudaMemcpyToSymbol(cuConstants, &poolConstants, sizeof(PoolConstants)));
 	dim3 dimBlock(16, 16);
 	dim3 dimGrid(WIDTH / 16, HEIGHT / 16);
-	curandSetupKernel<<<dimGrid, dimBlock>>>();
+	curandSetupKernel<<<dimGrid, dimBlock>>>(1578 + (unsigned long long)seed);
 	cudaDeviceSynchronize();
 }
 
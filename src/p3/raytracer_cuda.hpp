@@ -16,7 +16,8 @@ inline void gpuAssert(cudaError_t code, const char *file, int line, bool abort=t
 }
 
 extern void cudaRayTrace(CudaScene *scene, unsigned char *img);
-extern void cudaInitialize();
+// seed starts the per-pixel generators
+extern void cudaInitialize(unsigned int seed);
 
 void bindEnvmap (cudaArray *array, cudaChannelFormatDesc &channelDesc);
 
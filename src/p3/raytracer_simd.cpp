@@ -8,13 +8,18 @@
 #include "cycleTimer.h"
 #include "constants.hpp"
 #include "math/random462.hpp"
+#include "kernel_bench.hpp"
+#include "tile_stats.hpp"
 #include <immintrin.h>
+#include <cmath>
+#include <algorithm>
 #define PI 3.1415926535
 
 #define EPS 0.0001
 
 static PoolConstants cuConstants;// = poolConstants;
 static CudaScene cuScene;
+static TileStats *tileStats = nullptr;
 
 
 inline  static float3 quaternionXvector(float4 q, float3 vec)
@@ -173,6 +178,8 @@ static float distanceToSegment( float2 a, float2 b, float2 p )
 
 float *printBuffer_real;
 float *tempBuffer_real;
+// each thread has 128 floats of both
+static const int maxThreads = 12800 / 128;
 
 void simdInitialize()
 {
@@ -200,6 +207,13 @@ void printVec(__m128 vec)
 #define GT _mm_cmpgt_ps
 #define CMP _mm_cmp_ps
 #define BLEND _mm_blendv_ps
+#define AND _mm_and_ps
+#define OR _mm_or_ps
+#define SQRT _mm_sqrt_ps
+#define LOAD _mm_load_ps
+#define STORE _mm_store_ps
+#define VEC __m128
+#define VEC_WIDTH 4
 
 #define PLANE_INTERSECT(geo, a0, a1, a2, v0, v1, v2) \
 B = SET1(cuConstants.positions[geo] - ray_e.a0); \
@@ -209,25 +223,25 @@ B = SET1(cuConstants.lower_bounds[geo].a1);\
 M1 = GT(C, B);\
 B = SET1(cuConstants.upper_bounds[geo].a1);\
 M2 = LT(C, B);\
-M1 = _mm_and_ps(M1, M2);\
+M1 = AND(M1, M2);\
 C = MUL(A, v2);\
 B = SET1(ray_e.a2);\
 C = ADD(C, B);\
 B = SET1(cuConstants.lower_bounds[geo].a2);\
 M2 = GT(C, B);\
-M1 = _mm_and_ps(M1, M2);\
+M1 = AND(M1, M2);\
 B = SET1(cuConstants.upper_bounds[geo].a2);\
 M2 = LT(C, B);\
-M1 = _mm_and_ps(M1, M2);\
+M1 = AND(M1, M2);\
 B = SET1(0.0001); \
 M2 = GT(A, B);\
-M1 = _mm_and_ps(M1, M2);\
+M1 = AND(M1, M2);\
 M2 = LT(A, D);\
-M1 = _mm_and_ps(M1, M2);\
-D = _mm_blendv_ps(D, A, M1);\
+M1 = AND(M1, M2);\
+D = BLEND(D, A, M1);\
 B = SET1(geo + 0.0);\
-G = _mm_blendv_ps(G, B, M1);\
-M0 = _mm_or_ps(M0, M1);\
+G = BLEND(G, B, M1);\
+M0 = OR(M0, M1);\
 
 #define RANDOMIZE  \
 for (int q = 0; q < 4; q++) { \
@@ -243,6 +257,8 @@ T = _mm256_floor_ps(R); \
 R = SUB(R, T); 
 */
 
+#include "simd_kernels.hpp"
+
 void simdRayTrace(CudaScene *scene, unsigned char *img)
 {
 	double startTime = CycleTimer::currentSeconds();
@@ -250,11 +266,13 @@ void simdRayTrace(CudaScene *scene, unsigned char *img)
 	cuConstants = poolConstants;
 	int tid = 0;
 	float3 ray_e = cuScene.cam_position;
+	TileStats *stats = tileStats;
+	int tileSize = stats ? stats->get_tile_size() : WIDTH;
 #ifdef MTHREAD
 	#pragma omp parallel 
 #endif
 	{
-	__m128 A, B, C, D, E, S, S0, G, V0x, V0y, V0z, V1x, V1y, V1z, C0x, C0y, C0z, M0, M1, M2, M3, S1;
+	__m128 A, B, C, D, S, S0, G, V0x, V0y, V0z, V1x, V1y, V1z, C0x, C0y, C0z, M0, M3, S1;
 	__m128 C1x, C1y, C1z;
 	__m128 C2x, C2y, C2z;
 	__m128 V2x, V2y, V2z;
@@ -274,11 +292,18 @@ void simdRayTrace(CudaScene *scene, unsigned char *img)
 	#pragma omp for private(tid) schedule(dynamic)
 #endif
 	for (int y = cuScene.y0; y < cuScene.y0 + cuScene.render_height; y++) {
+		// rows go to whichever thread is free, a seeded run
+		// draws the same numbers for a row whatever thread renders it
+		random_seed_stream(cuScene.sample0 * HEIGHT + y);
+		unsigned long long tileStart = 0;
 		for (int x0 = 0; x0 < WIDTH; x0 += 4) {
 			int w = (y  - cuScene.y0)* WIDTH + x0;
+			if (stats && x0 % tileSize == 0)
+				tileStart = CycleTimer::currentTicks();
 			C2x = SET1(0); C2y = SET1(0); C2z = SET1(0);
-			for (int sampleX = 0; sampleX < NSAMPLES; sampleX++)
-			for (int sampleY = 0; sampleY < NSAMPLES; sampleY++) {
+			for (int sample = cuScene.sample0; sample < cuScene.sample0 + cuScene.sample_count; sample++) {
+			int sampleX = sample / NSAMPLES;
+			int sampleY = sample % NSAMPLES;
 			//printf("%d\n", tid);
 			V0x = SET1(cuScene.dir.x);
 			V0y = SET1(cuScene.dir.y);
@@ -311,43 +336,13 @@ void simdRayTrace(CudaScene *scene, unsigned char *img)
 			G = _mm_set1_ps(-1.0);
 			int isSpheres, isPlanes;
 			D = SET1(10000.0); // tmin
-			for (int i = 0; i < SPHERES; i++) {
-				float3 t_ray_e = cuScene.cam_position - cuScene.ball_position[i];
-				float SC = dot(t_ray_e, t_ray_e) - 1;
-				B = SET1(t_ray_e.x); A = MUL(V0x, B);
-				B = SET1(t_ray_e.y); C = MUL(V0y, B); A = ADD(A, C);
-				B = SET1(t_ray_e.z); C = MUL(V0z, B); A = ADD(A, C); // A = dot(ray_d, t_ray_e)
-				C = A;
-				B = SET1(0);
-				C = SUB(B, C); // C = -B
-				A = MUL(A, A); // A = B2
-				B = SET1(SC);
-				A = SUB(A, B); // A = B2 - C
-				A = _mm_sqrt_ps(A); // A = sqrt(B2 - C)
-				C = SUB(C, A); // C = -B - sqrt(B2 - C) == t
-				B = SET1(EPS);
-				M0 = GT(C, B); // M0 = A > B
-				M1 = LT(C, D); // M0 = A > B
-				M0 = _mm_and_ps(M0, M1);
-				A = SET1(i);
-				G = _mm_blendv_ps(G, A, M0); // G is geom
-				D = _mm_blendv_ps(D, C, M0); // D is tmin
-			}
+			sphereIntersect4(ray_e, V0x, V0y, V0z, D, G);
 			A = SET1(9999.0);
 			M0 = LT(D, A);
 			M3 = M0;
 			isSpheres = _mm_movemask_ps(M0);
 			isSpheres &= 255;
-			M0 = SET1(0);
-			PLANE_INTERSECT(0, y, x, z, V0y, V0x, V0z);
-			PLANE_INTERSECT(1, y, x, z, V0y, V0x, V0z);
-			PLANE_INTERSECT(2, y, x, z, V0y, V0x, V0z);
-			PLANE_INTERSECT(3, y, x, z, V0y, V0x, V0z);
-			PLANE_INTERSECT(4, y, x, z, V0y, V0x, V0z);
-			PLANE_INTERSECT(5, x, y, z, V0x, V0y, V0z);
-			PLANE_INTERSECT(6, x, y, z, V0x, V0y, V0z);
-			PLANE_INTERSECT(7, z, x, y, V0z, V0x, V0y);
-			PLANE_INTERSECT(8, z, x, y, V0z, V0x, V0y);
+			M0 = planeIntersect4(ray_e, V0x, V0y, V0z, D, G);
 			isPlanes = _mm_movemask_ps(M0);
 			isPlanes &= 255;
 			isSpheres &= ~isPlanes;
@@ -436,33 +431,8 @@ void simdRayTrace(CudaScene *scene, unsigned char *img)
 				B = MUL(A, V1x); V2x = ADD(V2x, B);
 				B = MUL(A, V1y); V2y = ADD(V2y, B);
 				B = MUL(A, V1z); V2z = ADD(V2z, B); //V2 = light_dir
-				S = SET1(1.0);
 				// Shadow
-				for (int j = 0; j < SPHERES; j++) {
-					B = SET1(cuScene.ball_position[j].x); V3x = SUB(V4x, B);
-					B = SET1(cuScene.ball_position[j].y); V3y = SUB(V4y, B);
-					B = SET1(cuScene.ball_position[j].z); V3z = SUB(V4z, B); // V3 = V4 - ballpos = ray_e
-
-					//float3 t_ray_e = ray_e - cuScene.ball_position[j];
-					A = MUL(V2x, V3x);
-					C = MUL(V2y, V3y); A = ADD(A, C);
-					C = MUL(V2z, V3z); A = ADD(A, C); // A = dot(ray_d, ray_e);
-					B = SET1(0); A = SUB(B, A); // A = -dot(ray_d, ray_e);
-					C = MUL(A, A); // C = b * b;
-					B = MUL(V3x, V3x); E = MUL(V3y, V3y);
-					B = ADD(B, E); // B = dot(ray_e, ray_e);
-					E = MUL(V3z, V3z); B = ADD(B, E); B = SUB(B, C); // B = dot - b * b;
-					B = _mm_sqrt_ps(B); C = SET1(1.0);
-					B = SUB(B, C); // B = h
-					C = SET1(16.0); B = MUL(B, C); B = DIV(B, A); // B = res
-					E = SET1(0.0);
-					M0 = GT(A, E); M1 = LT(B, E);
-					B = BLEND(B, E, M1);
-
-					M1 = LT(B, S);
-					M0 = _mm_and_ps(M0, M1);
-					S = BLEND(S, B, M0);
-				}
+				S = shadowFactor4(V4x, V4y, V4z, V2x, V2y, V2z);
 				S0 = ADD(S0, S);
 			}
 			B = SET1(1.0 / SHADOW_RAYS);
@@ -510,28 +480,109 @@ void simdRayTrace(CudaScene *scene, unsigned char *img)
 			B = SET1(0.0); M0 = LT(G, B);
 			C2x = ADD(C2x, C0x); C2y = ADD(C2y, C0y); C2z = ADD(C2z, C0z);
 		} // SAMPLES
-			C2x = _mm_sqrt_ps(C2x);
-			C2y = _mm_sqrt_ps(C2y);
-			C2z = _mm_sqrt_ps(C2z);
-			B = SET1(1.0 / NSAMPLES);
-			C2x = MUL(C2x, B);
-			C2y = MUL(C2y, B);
-			C2z = MUL(C2z, B);
-
-			B = SET1(1.0);
-			M2 = GT(C2x, B); C2x = BLEND(C2x, B, M2); //CLAMP
-			M2 = GT(C2y, B); C2y = BLEND(C2y, B, M2);
-			M2 = GT(C2z, B); C2z = BLEND(C2z, B, M2);
-			_mm_store_ps(tempBuffer, C2x);
-			_mm_store_ps(tempBuffer + 8, C2y);
-			_mm_store_ps(tempBuffer + 16, C2z);
-			for (int i = 0; i < 4; i++) {
-				img[3 * w + 3 * i] = 255 * tempBuffer[i];
-				img[3 * w + 3 * i + 1] = 255 * tempBuffer[8 + i];
-				img[3 * w + 3 * i + 2] = 255 * tempBuffer[16 + i];
+			packPixels4(C2x, C2y, C2z, cuScene.sample_count, tempBuffer, img + 3 * w);
+			// the row's part of the tile is done, every lane cast its shadow rays
+			if (stats && ((x0 + 4) % tileSize == 0 || x0 + 4 >= WIDTH)) {
+				int pixels = x0 + 4 - x0 / tileSize * tileSize;
+				unsigned long long primary = (unsigned long long)pixels * cuScene.sample_count;
+				stats->add(x0 / tileSize, y / tileSize, CycleTimer::currentTicks() - tileStart,
+					pixels, primary, primary * SHADOW_RAYS);
 			}
 		} // x = 0 -> WIDTH
 	} // y = 0 -> HEIGHT
 	}
 	printf("SIMD rendering time: %lf\n", CycleTimer::currentSeconds() - startTime);
 }
+
+RayStats simdRayStats()
+{
+	RayStats stats;
+	stats.primary_rays = (unsigned long long)WIDTH * cuScene.render_height * cuScene.sample_count;
+	stats.shadow_rays = stats.primary_rays * SHADOW_RAYS;
+	return stats;
+}
+
+void simdTileStats(TileStats *stats)
+{
+	tileStats = stats;
+}
+
+void simdSetThreads(int threads)
+{
+#ifdef MTHREAD
+	omp_set_num_threads(std::max(1, std::min(threads, maxThreads)));
+#endif
+}
+
+int simdMaxThreads()
+{
+#ifdef MTHREAD
+	return std::min(omp_get_num_procs(), maxThreads);
+#else
+	return 1;
+#endif
+}
+
+// the 8 wide forms of the kernels, only run by kernel_bench for now.
+// GCC builds them for AVX2 whatever the flags of the build, and they only
+// run on cpus having it. Built for AVX alone, they ran slower than the
+// SSE forms
+#if (defined(__GNUC__) && !defined(__clang__)) || defined(__AVX2__)
+#define SIMD_KERNELS_AVX
+
+#ifndef __AVX2__
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#endif
+
+#undef SET1
+#undef ADD
+#undef SUB
+#undef MUL
+#undef DIV
+#undef LT
+#undef GT
+#undef BLEND
+#undef AND
+#undef OR
+#undef SQRT
+#undef LOAD
+#undef STORE
+#undef VEC
+#undef VEC_WIDTH
+#define SET1 _mm256_set1_ps
+#define ADD _mm256_add_ps
+#define SUB _mm256_sub_ps
+#define MUL _mm256_mul_ps
+#define DIV _mm256_div_ps
+#define LT(a, b) _mm256_cmp_ps(a, b, _CMP_LT_OS)
+#define GT(a, b) _mm256_cmp_ps(a, b, _CMP_GT_OS)
+#define BLEND _mm256_blendv_ps
+#define AND _mm256_and_ps
+#define OR _mm256_or_ps
+#define SQRT _mm256_sqrt_ps
+#define LOAD _mm256_load_ps
+#define STORE _mm256_store_ps
+#define VEC __m256
+#define VEC_WIDTH 8
+
+#include "simd_kernels.hpp"
+
+#ifndef __AVX2__
+#pragma GCC pop_options
+#endif
+#endif
+
+bool simdRunKernel(BenchKernel kernel, int width, const CudaScene& scene, KernelRays& rays)
+{
+	cuScene = scene;
+	cuConstants = poolConstants;
+	if (width == 4)
+		return runKernel4(kernel, rays, tempBuffer_real);
+#ifdef SIMD_KERNELS_AVX
+	__builtin_cpu_init();
+	if (width == 8 && __builtin_cpu_supports("avx2"))
+		return runKernel8(kernel, rays, tempBuffer_real);
+#endif
+	return false;
+}
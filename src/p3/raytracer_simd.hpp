@@ -3,9 +3,23 @@
 
 #include "cudaScene.hpp"
 
+class TileStats;
+
 extern void simdRayTrace(CudaScene *scene, unsigned char *img);
 
 extern void simdInitialize();
 
+// rays cast by the last simdRayTrace. Every lane casts its shadow
+// rays, hit or not, so they only depend on the size of the scene
+extern RayStats simdRayStats();
+
+// threads simdRayTrace renders with, at most simdMaxThreads()
+extern void simdSetThreads(int threads);
+extern int simdMaxThreads();
+
+// adds what each tile costs simdRayTrace to stats, until it is
+// called again with nullptr. The tiles are timed a row at a time
+extern void simdTileStats(TileStats *stats);
+
 
 #endif
@@ -7,6 +7,9 @@
 #include "cycleTimer.h"
 #include "constants.hpp"
 #include "math/random462.hpp"
+#include "kernel_bench.hpp"
+#include "tile_stats.hpp"
+#include <vector>
 #define PI 3.1415926535
 
 #define EPS 0.0001
@@ -14,6 +17,8 @@
 
 static PoolConstants cuConstants;// = poolConstants;
 static CudaScene cuScene;
+static RayStats rayStats;
+static TileStats *tileStats = nullptr;
 
 inline  static float3 quaternionXvector(float4 q, float3 vec)
 {
@@ -281,14 +286,29 @@ void singleRayTrace(CudaScene *scene, unsigned char *img)
 	//CudaScene &cuScene = *scene;
 	cuScene = *scene;
 	cuConstants = poolConstants;
+	unsigned long long hits = 0;
+
+	// the costs of the tiles, added to the stats once the frame is done
+	TileStats *stats = tileStats;
+	int tileSize = stats ? stats->get_tile_size() : 1;
+	int tileColumns = stats ? stats->get_columns() : 0;
+	std::vector<unsigned long long> tileTicks, tilePixels, tileHits;
+	if (stats) {
+		tileTicks.resize(stats->get_columns() * stats->get_rows());
+		tilePixels.resize(tileTicks.size());
+		tileHits.resize(tileTicks.size());
+	}
 
 	for (int x = 0; x < WIDTH; x++)
-	for (int y = 0; y < HEIGHT; y++) {
-	int w = y * WIDTH + x;
+	for (int y = cuScene.y0; y < cuScene.y0 + cuScene.render_height; y++) {
+	int w = (y - cuScene.y0) * WIDTH + x;
+	unsigned long long pixelStart = stats ? CycleTimer::currentTicks() : 0;
+	unsigned long long pixelHits = hits;
 	float3 accumulated_color = make_float3(0.0, 0.0, 0.0);
 	// Jittered Sampling
-	for (int sampleX = 0; sampleX < NSAMPLES; sampleX++)
-	for (int sampleY = 0; sampleY < NSAMPLES; sampleY++) {
+	for (int sample = cuScene.sample0; sample < cuScene.sample0 + cuScene.sample_count; sample++) {
+		int sampleX = sample / NSAMPLES;
+		int sampleY = sample % NSAMPLES;
 		float di = (x + (sampleX + random_uniform()) / NSAMPLES) / WIDTH * 2 - 1;
 		float dj = (y + (sampleY + random_uniform()) / NSAMPLES) / HEIGHT * 2 - 1;
 		float3 ray_d = normalize(cuScene.dir + dj * cuScene.cU + di * cuScene.ARcR);
@@ -307,6 +327,7 @@ void singleRayTrace(CudaScene *scene, unsigned char *img)
 		float3 color = make_float3(0, 0, 0);
 
 		if (geom >= 0) {
+			hits++;
 			float3 hit = tmin * ray_d + ray_e;
 			// Normal
 			float3 normal;
@@ -361,12 +382,102 @@ void singleRayTrace(CudaScene *scene, unsigned char *img)
 			accumulated_color += make_float3(0.7, 0.9, 1.0);
 		}
 	}
-	accumulated_color /= NSAMPLES * NSAMPLES;
+	accumulated_color /= cuScene.sample_count;
 	uchar3 col0;
 	col0.x = clamp(powf(accumulated_color.x, 0.50) * 255, 0.0, 255.0);
 	col0.y = clamp(powf(accumulated_color.y, 0.50) * 255, 0.0, 255.0);
 	col0.z = clamp(powf(accumulated_color.z, 0.50) * 255, 0.0, 255.0);
 	*((uchar3 *)img + w) = col0;
+	if (stats) {
+		int tile = y / tileSize * tileColumns + x / tileSize;
+		tileTicks[tile] += CycleTimer::currentTicks() - pixelStart;
+		tilePixels[tile]++;
+		tileHits[tile] += hits - pixelHits;
+	}
 	}
+	for (size_t tile = 0; tile < tileTicks.size(); tile++) {
+		if (tilePixels[tile] == 0)
+			continue;
+		stats->add(tile % tileColumns, tile / tileColumns, tileTicks[tile], tilePixels[tile],
+			tilePixels[tile] * cuScene.sample_count, tileHits[tile] * SHADOW_RAYS);
+	}
+	rayStats.primary_rays = (unsigned long long)WIDTH * cuScene.render_height * cuScene.sample_count;
+	rayStats.shadow_rays = hits * SHADOW_RAYS;
 	printf("CPU rendering time: %lf\n", CycleTimer::currentSeconds() - startTime);
 }
+
+void singleTileStats(TileStats *stats)
+{
+	tileStats = stats;
+}
+
+RayStats singleRayStats()
+{
+	return rayStats;
+}
+
+// the i-th ray of a KernelRays
+#define BENCH_RAY(rays, i) \
+	float3 ray_d = make_float3(rays.dx[i], rays.dy[i], rays.dz[i]); \
+	float3 ray_e = make_float3(rays.ox[i], rays.oy[i], rays.oz[i]);
+
+void singleRunKernel(BenchKernel kernel, const CudaScene& scene, KernelRays& rays)
+{
+	cuScene = scene;
+	cuConstants = poolConstants;
+
+	switch (kernel) {
+	case KERNEL_SPHERES:
+		for (int i = 0; i < rays.count; i++) {
+			BENCH_RAY(rays, i);
+			int geom = -1;
+			rays.t[i] = sphereIntersectionTestAll(ray_d, ray_e, geom);
+			rays.geom[i] = geom;
+		}
+		break;
+	case KERNEL_PLANES:
+		for (int i = 0; i < rays.count; i++) {
+			BENCH_RAY(rays, i);
+			int geom = -1;
+			rays.t[i] = planeIntersectionTestAll(ray_d, ray_e, geom, 10000.0);
+			rays.geom[i] = geom;
+		}
+		break;
+	case KERNEL_SHADOW:
+		for (int i = 0; i < rays.count; i++) {
+			BENCH_RAY(rays, i);
+			rays.t[i] = trace_shadow(ray_e, ray_d);
+		}
+		break;
+	case KERNEL_MATERIAL:
+		for (int i = 0; i < rays.count; i++) {
+			float3 ray_d = make_float3(rays.dx[i], rays.dy[i], rays.dz[i]);
+			float3 color = do_material(i % SPHERES, ray_d);
+			rays.color[0][i] = color.x;
+			rays.color[1][i] = color.y;
+			rays.color[2][i] = color.z;
+		}
+		break;
+	case KERNEL_QUATERNION:
+		for (int i = 0; i < rays.count; i++) {
+			float3 ray_d = make_float3(rays.dx[i], rays.dy[i], rays.dz[i]);
+			float3 point = quaternionXCvector(cuScene.ball_orientation[i % SPHERES], ray_d);
+			rays.color[0][i] = point.x;
+			rays.color[1][i] = point.y;
+			rays.color[2][i] = point.z;
+		}
+		break;
+	case KERNEL_PACK:
+		// the squared direction is the color of a single sample
+		for (int i = 0; i < rays.count; i++) {
+			float3 ray_d = make_float3(rays.dx[i], rays.dy[i], rays.dz[i]);
+			float3 color = ray_d * ray_d;
+			rays.pixels[3 * i] = clamp(powf(color.x, 0.50) * 255, 0.0, 255.0);
+			rays.pixels[3 * i + 1] = clamp(powf(color.y, 0.50) * 255, 0.0, 255.0);
+			rays.pixels[3 * i + 2] = clamp(powf(color.z, 0.50) * 255, 0.0, 255.0);
+		}
+		break;
+	default:
+		break;
+	}
+}
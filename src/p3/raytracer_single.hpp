@@ -3,7 +3,16 @@
 
 #include "cudaScene.hpp"
 
+class TileStats;
+
 extern void singleRayTrace(CudaScene *scene, unsigned char *img);
 
+// rays cast by the last singleRayTrace, shadow rays only leave hits
+extern RayStats singleRayStats();
+
+// adds what each tile costs singleRayTrace to stats, until it is
+// called again with nullptr
+extern void singleTileStats(TileStats *stats);
+
 
 #endif
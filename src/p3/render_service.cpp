@@ -0,0 +1,390 @@
+#include "render_service.hpp"
+#include "protocol.hpp"
+#include "constants.hpp"
+#include "cycleTimer.h"
+
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <iostream>
+#include <unistd.h>
+
+int RenderService::queue_capacity = 64;
+int RenderService::max_batch = 16;
+
+// scenes a client may send in one message
+static const int max_request_scenes = 256;
+
+// how often the throughput is printed, in seconds
+static const double stats_interval = 5.0;
+
+static int tile_length(const CudaScene& scene)
+{
+	return sizeof(WireHeader) + sizeof(TilePrefix) + WIDTH * scene.render_height * PIXEL_SIZE;
+}
+
+ServiceConnection::ServiceConnection(socket_type socket_, RenderService& service_)
+	: socket(std::move(socket_)),
+	  read_msg(sizeof(WireHeader) + max_request_scenes * (sizeof(WireHeader) + scene_payload_length)),
+	  closed(false), service(service_)
+{
+}
+
+void ServiceConnection::start()
+{
+	do_read_header();
+}
+
+void ServiceConnection::send(MessagePtr msg)
+{
+	auto self(shared_from_this());
+	service.io_service.post(
+	[this, self, msg]()
+	{
+		if(closed)
+			return;
+
+		bool write_in_progress = !write_msgs.empty();
+		write_msgs.push_back(msg);
+		if (!write_in_progress)
+		{
+			do_write();
+		}
+	});
+}
+
+void ServiceConnection::resume()
+{
+	if(closed)
+		return;
+
+	if(service.offer(shared_from_this()))
+		do_read_header();
+}
+
+void ServiceConnection::close(const boost::system::error_code& ec)
+{
+	if(closed)
+		return;
+
+	closed = true;
+	write_msgs.clear();
+	pending.clear();
+	boost::system::error_code ignored;
+	socket.close(ignored);
+}
+
+void ServiceConnection::do_read_header()
+{
+	auto self(shared_from_this());
+	boost::asio::async_read(socket,
+		boost::asio::buffer(read_msg.data(), Message::header_length),
+		[this, self](boost::system::error_code ec, std::size_t /*length*/)
+		{
+			if (!ec && read_msg.decode_header())
+			{
+				do_read_body();
+			}
+			else
+			{
+				close(ec);
+			}
+		});
+}
+
+void ServiceConnection::do_read_body()
+{
+	auto self(shared_from_this());
+	boost::asio::async_read(socket,
+		boost::asio::buffer(read_msg.body(), read_msg.body_length()),
+		[this, self](boost::system::error_code ec, std::size_t /*length*/)
+		{
+			if (ec)
+			{
+				close(ec);
+			}
+			else if (!read_requests(read_msg))
+			{
+				std::cout<<"malformed render request, dropping the client"<<std::endl;
+				close(boost::asio::error::invalid_argument);
+			}
+			else if (service.offer(self))
+			{
+				do_read_header();
+			}
+			// else the queue is full, we read again once it has room
+		});
+}
+
+void ServiceConnection::do_write()
+{
+	auto self(shared_from_this());
+	boost::asio::async_write(socket,
+		boost::asio::buffer(write_msgs.front()->data(), write_msgs.front()->length()),
+		[this, self](boost::system::error_code ec, std::size_t /*length*/)
+		{
+			if (closed)
+				return;
+
+			if (!ec)
+			{
+				write_msgs.pop_front();
+				if (!write_msgs.empty())
+				{
+					do_write();
+				}
+			}
+			else
+			{
+				close(ec);
+			}
+		});
+}
+
+bool ServiceConnection::read_requests(const Message& message)
+{
+	double received_time = CycleTimer::currentSeconds();
+	auto self(shared_from_this());
+	bool valid = true;
+
+	bool framed = for_each_wire_message(message.body(), message.body_length(),
+		[this, self, received_time, &valid](const WireHeader& header, const char* payload, int available_length)
+		{
+			if(header.type != WIRE_SCENE || available_length != scene_payload_length
+				|| header.x0 != 0 || header.width != WIDTH || header.height == 0
+				|| header.y0 + header.height > HEIGHT) {
+				valid = false;
+				return false;
+			}
+
+			ServiceRequest request;
+			decode_scene(payload, request.scene);
+			if(request.scene.sample_count <= 0 
+				|| request.scene.sample0 + request.scene.sample_count > NSAMPLES * NSAMPLES) {
+				valid = false;
+				return false;
+			}
+			request.scene.y0 = header.y0;
+			request.scene.render_height = header.height;
+			request.frame_id = header.frame_id;
+			request.received_time = received_time;
+			request.connection = self;
+			pending.push_back(request);
+			return true;
+		});
+
+	return framed && valid;
+}
+
+RenderService::RenderService(const std::string& socket_path,
+	std::function<void(CudaScene& scene, unsigned char* img)> const& render)
+	: socket_path(socket_path), render(render),
+	  acceptor(io_service), socket(io_service),
+	  stats_start(0), stats_images(0), stats_batches(0)
+{
+}
+
+bool RenderService::run()
+{
+	// a socket left behind by a previous run
+	::unlink(socket_path.c_str());
+
+	boost::system::error_code ec;
+	boost::asio::local::stream_protocol::endpoint endpoint(socket_path);
+	acceptor.open(endpoint.protocol(), ec);
+	if(!ec)
+		acceptor.bind(endpoint, ec);
+	if(!ec)
+		acceptor.listen(boost::asio::socket_base::max_connections, ec);
+	if(ec) {
+		std::cout<<"can't listen on "<<socket_path<<": "<<ec.message()<<std::endl;
+		return false;
+	}
+
+	std::cout<<"render service listening on "<<socket_path<<std::endl;
+
+	do_accept();
+	boost::thread io_thread(boost::bind(&boost::asio::io_service::run, &io_service));
+
+	stats_start = CycleTimer::currentSeconds();
+	std::vector<ServiceRequest> batch;
+	while(true)
+	{
+		take_batch(batch);
+		render_batch(batch);
+		print_stats();
+	}
+
+	return true;
+}
+
+void RenderService::do_accept()
+{
+	acceptor.async_accept(socket,
+		[this](boost::system::error_code ec)
+		{
+			if (!ec)
+			{
+				std::make_shared<ServiceConnection>(std::move(socket), *this)->start();
+			}
+
+			do_accept();
+		});
+}
+
+bool RenderService::offer(ServiceConnectionPtr connection)
+{
+	bool added = false;
+	{
+		std::lock_guard<std::mutex> lock(queue_mutex);
+		while(!connection->pending.empty() && (int)queue.size() < queue_capacity)
+		{
+			queue.push_back(connection->pending.front());
+			connection->pending.pop_front();
+			added = true;
+		}
+	}
+	if(added)
+		queue_cond.notify_one();
+
+	if(connection->pending.empty())
+		return true;
+
+	blocked.push_back(connection);
+	return false;
+}
+
+void RenderService::take_batch(std::vector<ServiceRequest>& batch)
+{
+	batch.clear();
+	{
+		std::unique_lock<std::mutex> lock(queue_mutex);
+		while(queue.empty()) {
+			queue_cond.wait(lock);
+		}
+
+		// everything that arrived while the last batch was rendered
+		int n = std::min<int>(queue.size(), max_batch);
+		batch.assign(queue.begin(), queue.begin() + n);
+		queue.erase(queue.begin(), queue.begin() + n);
+	}
+
+	// there is room for the clients that were held back
+	io_service.post(boost::bind(&RenderService::resume_blocked, this));
+}
+
+void RenderService::resume_blocked()
+{
+	std::deque<ServiceConnectionPtr> waiting;
+	waiting.swap(blocked);
+	for(auto& connection : waiting) {
+		connection->resume();
+	}
+}
+
+void RenderService::render_batch(std::vector<ServiceRequest>& batch)
+{
+	// a client that left gets nothing
+	batch.erase(std::remove_if(batch.begin(), batch.end(),
+		[](const ServiceRequest& r) { return r.connection->closed.load(); }), batch.end());
+	if(batch.empty())
+		return;
+
+	// the tiles of each client go in one message, in the order asked
+	std::vector<ServiceConnectionPtr> clients;
+	std::vector<int> tiles, lengths;
+	std::vector<int> client_of(batch.size());
+	for(int i=0;i<(int)batch.size();i++)
+	{
+		int c = std::find(clients.begin(), clients.end(), batch[i].connection) - clients.begin();
+		if(c == (int)clients.size()) {
+			clients.push_back(batch[i].connection);
+			tiles.push_back(0);
+			lengths.push_back(0);
+		}
+		client_of[i] = c;
+		tiles[c]++;
+		lengths[c] += tile_length(batch[i].scene);
+	}
+
+	std::vector<MessagePtr> msgs(clients.size());
+	std::vector<int> offsets(clients.size());
+	for(int c=0;c<(int)clients.size();c++)
+	{
+		bool batched = tiles[c] > 1;
+		int body_length = lengths[c] + (batched ? sizeof(WireHeader) : 0);
+		msgs[c] = new Message(body_length);
+		msgs[c]->set_body_length(body_length);
+		offsets[c] = 0;
+		if(batched) {
+			WireHeader header = make_wire_header(WIRE_BATCH, 0, 0, 0, lengths[c]);
+			write_wire_message(msgs[c]->body(), header, nullptr);
+			offsets[c] = sizeof(WireHeader);
+		}
+	}
+
+	std::vector<char*> prefixes(batch.size());
+	for(int i=0;i<(int)batch.size();i++)
+	{
+		ServiceRequest& r = batch[i];
+		int c = client_of[i];
+		char* tile = msgs[c]->body() + offsets[c];
+		offsets[c] += tile_length(r.scene);
+
+		unsigned char* img = reinterpret_cast<unsigned char*>(tile + sizeof(WireHeader) + sizeof(TilePrefix));
+		double render_start = CycleTimer::currentSeconds();
+		render(r.scene, img);
+		double render_end = CycleTimer::currentSeconds();
+
+		WireHeader header = make_wire_header(WIRE_TILE, r.frame_id, r.scene.y0, r.scene.render_height,
+			tile_length(r.scene) - sizeof(WireHeader));
+		header.codec = CODEC_RGB8;
+		std::memcpy(tile, &header, sizeof(header));
+
+		TilePrefix prefix;
+		std::memset(&prefix, 0, sizeof(prefix));
+		prefix.rendering_latency = render_end - render_start;
+		prefix.sample0 = r.scene.sample0;
+		prefix.sample_count = r.scene.sample_count;
+		prefix.received_time = r.received_time;
+		prefix.render_start = render_start;
+		prefix.render_end = render_end;
+		std::memcpy(tile + sizeof(WireHeader), &prefix, sizeof(prefix));
+		prefixes[i] = tile + sizeof(WireHeader);
+	}
+
+	double send_time = CycleTimer::currentSeconds();
+	for(char* prefix : prefixes) {
+		std::memcpy(prefix + offsetof(TilePrefix, send_time), &send_time, sizeof(send_time));
+	}
+	for(int c=0;c<(int)clients.size();c++) {
+		msgs[c]->encode_header();
+		clients[c]->send(msgs[c]);
+	}
+
+	stats_images += batch.size();
+	stats_batches++;
+}
+
+void RenderService::print_stats()
+{
+	double now = CycleTimer::currentSeconds();
+	double seconds = now - stats_start;
+	if(seconds < stats_interval)
+		return;
+
+	int queued;
+	{
+		std::lock_guard<std::mutex> lock(queue_mutex);
+		queued = queue.size();
+	}
+
+	printf("%.1f images/s, %.1f images per batch, %d queued\n",
+		stats_images / seconds, stats_batches > 0 ? (double)stats_images / stats_batches : 0.0, queued);
+
+	stats_start = now;
+	stats_images = 0;
+	stats_batches = 0;
+}
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <boost/asio.hpp>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "cudaScene.hpp"
+#include "message.hpp"
+
+class RenderService;
+class ServiceConnection;
+
+typedef std::shared_ptr<ServiceConnection> ServiceConnectionPtr;
+
+// a scene to render for a client. The frame id is the client's,
+// the tile sent back carries it
+struct ServiceRequest
+{
+	CudaScene scene;
+	unsigned int frame_id;
+	double received_time;
+	ServiceConnectionPtr connection;
+};
+
+// A client of the render service, on the local socket
+class ServiceConnection
+: public std::enable_shared_from_this<ServiceConnection>
+{
+private:
+	typedef boost::asio::local::stream_protocol::socket socket_type;
+
+public:
+	ServiceConnection(socket_type socket, RenderService& service);
+
+	void start();
+
+	// queues a reply, safe to call from any thread
+	void send(MessagePtr msg);
+
+	// puts the requests that didn't fit in the queue in it, and
+	// reads more once all of them are in. Runs on the io thread
+	void resume();
+
+private:
+	friend class RenderService;
+
+	void do_read_header();
+	void do_read_body();
+	void do_write();
+	void close(const boost::system::error_code& ec);
+
+	// the scenes of the message read, false if it is malformed
+	bool read_requests(const Message& message);
+
+	socket_type socket;
+	Message read_msg;
+	std::deque<MessagePtr> write_msgs;
+	// requests read but not queued yet, the queue was full
+	std::deque<ServiceRequest> pending;
+	// read by the render thread, to skip the requests of a client that left
+	std::atomic<bool> closed;
+	RenderService& service;
+};
+
+// Renders scenes for clients on a local (unix) socket, without a window.
+// A client sends WIRE_SCENE messages, or WIRE_BATCH messages of them, and
+// gets a WIRE_TILE back for each, see protocol.hpp. The scene holds the
+// balls, the camera, the rows and the samples to render. There is no
+// hello, the client speaks PROTOCOL_VERSION.
+//
+// The requests wait in a queue of bounded size. The render thread takes
+// every request waiting, up to max_batch, renders them back to back and
+// sends each client its tiles of the batch in one message. When the
+// queue is full, a client isn't read from until there is room again, so
+// a fast client is slowed down to the rate the images are rendered at.
+// The backends keep the scene they render in static state, so the 
+// images of a batch are rendered one after the other, each of them
+// with all of the backend's threads
+class RenderService
+{
+public:
+
+	// requests waiting to be rendered, at most
+	static int queue_capacity;
+	// requests rendered before their tiles are sent, at most
+	static int max_batch;
+
+	// render fills a WIDTH-wide image with the scene's rows, it is only
+	// called from the thread calling run
+	RenderService(const std::string& socket_path,
+		std::function<void(CudaScene& scene, unsigned char* img)> const& render);
+
+	// serves until the process ends, false if the socket can't be opened
+	bool run();
+
+private:
+	friend class ServiceConnection;
+
+	// prevent from copying
+	RenderService(RenderService const& other) = delete;
+	void operator=(RenderService const& other) = delete;
+
+	void do_accept();
+
+	// moves what fits of the connection's pending requests to the queue.
+	// Returns false if some didn't fit, the connection is resumed later.
+	// Runs on the io thread
+	bool offer(ServiceConnectionPtr connection);
+
+	// takes the next batch, waits for one if the queue is empty
+	void take_batch(std::vector<ServiceRequest>& batch);
+	void render_batch(std::vector<ServiceRequest>& batch);
+	// gives the blocked connections another try, after the queue shrank
+	void resume_blocked();
+
+	void print_stats();
+
+	std::string socket_path;
+	std::function<void(CudaScene& scene, unsigned char* img)> render;
+
+	boost::asio::io_service io_service;
+	boost::asio::local::stream_protocol::acceptor acceptor;
+	boost::asio::local::stream_protocol::socket socket;
+
+	std::deque<ServiceRequest> queue;
+	std::mutex queue_mutex;
+	std::condition_variable queue_cond;
+	// connections waiting for room in the queue, only used on the io thread
+	std::deque<ServiceConnectionPtr> blocked;
+
+	// throughput, only used by the render thread
+	double stats_start;
+	int stats_images;
+	int stats_batches;
+};
@@ -0,0 +1,146 @@
+#include "row_cost_model.hpp"
+#include "cudaScene.hpp"
+#include "helper_math.h"
+
+#include <algorithm>
+#include <cmath>
+
+// how much more a row fully covered by balls costs than
+// its base cost. Ball hits spawn reflection and shadow rays
+static const double BALL_COST = 1.5;
+
+// weight of a new measurement in the base cost of its rows
+static const double MEASUREMENT_ALPHA = 0.2;
+
+// a single strip may move its rows' cost this much at most
+static const double MAX_MEASUREMENT_RATIO = 4.0;
+
+// radius of the balls in world units
+static const float BALL_RADIUS = 1.0f;
+
+RowCostModel::RowCostModel()
+{
+	for(int y=0;y<HEIGHT;y++)
+	{
+		base_cost[y] = 1;
+		ball_coverage[y] = 0;
+		cost_sum[y] = y;
+	}
+	cost_sum[HEIGHT] = HEIGHT;
+}
+
+void RowCostModel::predict(const CudaScene& scene)
+{
+	double coverage[HEIGHT];
+	std::fill(coverage, coverage + HEIGHT, 0.0);
+
+	// a ray of row y and column x goes along dir + dj * cU + di * ARcR,
+	// where dj and di run from -1 to 1 over the screen
+	float cu_len2 = dot(scene.cU, scene.cU);
+	float arcr_len2 = dot(scene.ARcR, scene.ARcR);
+	if(cu_len2 > 0 && arcr_len2 > 0)
+	{
+		for(int i=0;i<SPHERES;i++)
+		{
+			float3 v = scene.ball_position[i] - scene.cam_position;
+			float depth = dot(v, scene.dir);
+
+			// behind the camera, or the camera is inside the ball
+			if(depth <= BALL_RADIUS)
+				continue;
+
+			double yc = (dot(v, scene.cU) / (cu_len2 * depth) + 1) * 0.5 * HEIGHT;
+			double xc = (dot(v, scene.ARcR) / (arcr_len2 * depth) + 1) * 0.5 * WIDTH;
+			double ry = BALL_RADIUS / (std::sqrt(cu_len2) * depth) * 0.5 * HEIGHT;
+			double rx = BALL_RADIUS / (std::sqrt(arcr_len2) * depth) * 0.5 * WIDTH;
+
+			int y_begin = std::max(0, (int)std::floor(yc - ry));
+			int y_end = std::min(HEIGHT, (int)std::ceil(yc + ry) + 1);
+			for(int y=y_begin;y<y_end;y++)
+			{
+				double dy = (y + 0.5 - yc) / ry;
+				if(dy * dy >= 1)
+					continue;
+
+				double half_width = rx * std::sqrt(1 - dy * dy);
+				double visible = std::min<double>(WIDTH, xc + half_width) - std::max(0.0, xc - half_width);
+				if(visible > 0)
+					coverage[y] += visible / WIDTH;
+			}
+		}
+	}
+
+	predict(coverage);
+}
+
+void RowCostModel::predict(const double* coverage)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	std::copy(coverage, coverage + HEIGHT, ball_coverage);
+
+	// keep the base cost at 1 per row on average, so a slave's
+	// rendering factor stays comparable from frame to frame
+	double sum_base = 0;
+	for(int y=0;y<HEIGHT;y++) {
+		sum_base += base_cost[y];
+	}
+	double scale = HEIGHT / sum_base;
+
+	cost_sum[0] = 0;
+	for(int y=0;y<HEIGHT;y++)
+	{
+		base_cost[y] *= scale;
+		double coverage = std::min(1.0, ball_coverage[y]);
+		cost_sum[y + 1] = cost_sum[y] + base_cost[y] * (1 + BALL_COST * coverage);
+	}
+}
+
+void RowCostModel::add_measurement(int y0, int height, double seconds, double predicted_seconds)
+{
+	if(height <= 0 || y0 < 0 || y0 + height > HEIGHT || predicted_seconds <= 0 || seconds <= 0)
+		return;
+
+	double ratio = std::max(1 / MAX_MEASUREMENT_RATIO,
+		std::min(MAX_MEASUREMENT_RATIO, seconds / predicted_seconds));
+	double factor = 1 + MEASUREMENT_ALPHA * (ratio - 1);
+
+	std::lock_guard<std::mutex> lock(mutex);
+	for(int y=y0;y<y0 + height;y++) {
+		base_cost[y] *= factor;
+	}
+}
+
+double RowCostModel::get_cost(int y0, int height) const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	int y1 = std::min(HEIGHT, y0 + height);
+	y0 = std::max(0, y0);
+	if(y1 <= y0)
+		return 0;
+	return cost_sum[y1] - cost_sum[y0];
+}
+
+double RowCostModel::get_total_cost() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return cost_sum[HEIGHT];
+}
+
+int RowCostModel::find_row(double cost) const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if(cost <= 0)
+		return 0;
+	if(cost >= cost_sum[HEIGHT])
+		return HEIGHT;
+
+	// first row whose cost ends past 'cost'
+	int y = std::upper_bound(cost_sum + 1, cost_sum + HEIGHT + 1, cost) - (cost_sum + 1);
+	double row_cost = cost_sum[y + 1] - cost_sum[y];
+	if(row_cost > 0 && (cost - cost_sum[y]) / row_cost >= 0.5)
+		y++;
+	return y;
+}
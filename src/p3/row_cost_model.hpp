@@ -0,0 +1,59 @@
+#pragma once
+
+#include "constants.hpp"
+
+#include <mutex>
+
+struct CudaScene;
+
+// Predicted rendering cost of every row of the image.
+// Rows showing balls cost far more than rows of felt or sky,
+// so the master cuts the image at equal predicted cost instead
+// of equal rows. The cost of a row is a learned base cost, taken
+// from the measured rendering time of the strips, scaled up by how
+// much of the row the balls of the scene cover.
+// The base cost of a row is 1 on average, so the total cost of an
+// image is close to HEIGHT.
+class RowCostModel
+{
+public:
+
+	RowCostModel();
+
+	// projects the balls of the scene on screen and predicts
+	// the cost of every row for it
+	void predict(const CudaScene& scene);
+
+	// the same from the fraction of every row the balls cover
+	void predict(const double* coverage);
+
+	// folds in a measured strip: rows [y0, y0 + height) took 'seconds'
+	// to render, where the slave's estimates predicted 'predicted_seconds'
+	void add_measurement(int y0, int height, double seconds, double predicted_seconds);
+
+	// predicted cost of rows [y0, y0 + height)
+	double get_cost(int y0, int height) const;
+
+	double get_total_cost() const;
+
+	// the row at which the predicted cost counted from the
+	// top of the image reaches 'cost', rounded to the nearest row
+	int find_row(double cost) const;
+
+private:
+
+	// prevent from copying
+	RowCostModel(RowCostModel const& other) = delete;
+	void operator=(RowCostModel const& other) = delete;
+
+	// learned cost of each row
+	double base_cost[HEIGHT];
+
+	// fraction of each row covered by balls
+	double ball_coverage[HEIGHT];
+
+	// prefix sums of the predicted cost, cost_sum[y] is the cost of rows [0, y)
+	double cost_sum[HEIGHT + 1];
+
+	mutable std::mutex mutex;
+};
@@ -0,0 +1,110 @@
+#include "session_scheduler.hpp"
+
+#include <algorithm>
+
+SessionScheduler::SessionScheduler(int max_in_flight)
+	: max_in_flight(max_in_flight), virtual_now(0)
+{
+}
+
+int SessionScheduler::add_session(double target_fps, double weight, double now)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	Session s = Session();
+	s.target_fps = std::max(0.1, target_fps);
+	s.weight = std::max(0.01, weight);
+	s.next_frame_time = now;
+	s.virtual_time = virtual_now;
+	sessions.push_back(s);
+	return sessions.size() - 1;
+}
+
+int SessionScheduler::get_sessions_count() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return sessions.size();
+}
+
+PoolScene& SessionScheduler::get_scene(int idx)
+{
+	// the vector doesn't grow once the sessions are added
+	return sessions[idx].scene;
+}
+
+int SessionScheduler::pick(double now)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	int best = -1;
+	double best_start = 0;
+	for(int i=0;i<(int)sessions.size();i++)
+	{
+		const Session& s = sessions[i];
+		if(s.next_frame_time > now || s.frames_in_flight >= max_in_flight)
+			continue;
+
+		double start = std::max(s.virtual_time, virtual_now);
+		if(best < 0 || start < best_start) {
+			best = i;
+			best_start = start;
+		}
+	}
+	return best;
+}
+
+unsigned int SessionScheduler::issue(int idx, double now, double cost)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	Session& s = sessions[idx];
+	double start = std::max(s.virtual_time, virtual_now);
+	s.virtual_time = start + cost / s.weight;
+	virtual_now = start;
+
+	// a session that fell behind doesn't make up for the frames it 
+	// missed, that would only put it further behind
+	double interval = 1.0 / s.target_fps;
+	s.next_frame_time += interval;
+	if(s.next_frame_time < now - interval) {
+		s.frames_skipped += (int)((now - s.next_frame_time) / interval);
+		s.next_frame_time = now;
+	}
+
+	s.frames_in_flight++;
+	return ++s.frames_issued;
+}
+
+bool SessionScheduler::deliver(int idx, unsigned int number)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	Session& s = sessions[idx];
+	s.frames_delivered++;
+	if(number <= s.newest_delivered) {
+		s.frames_late++;
+		return false;
+	}
+	s.newest_delivered = number;
+	return true;
+}
+
+void SessionScheduler::finish(int idx)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	Session& s = sessions[idx];
+	s.frames_in_flight = std::max(0, s.frames_in_flight - 1);
+}
+
+Session SessionScheduler::take_stats(int idx)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	Session& s = sessions[idx];
+	Session stats = s;
+	s.frames_delivered = 0;
+	s.frames_late = 0;
+	s.frames_skipped = 0;
+	return stats;
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "PoolScene.hpp"
+
+#include <mutex>
+#include <vector>
+
+// One table of a multi-session master: its own balls and camera, 
+// and the rate it wants frames at. Each of its frames goes whole
+// to one slave
+struct Session
+{
+	PoolScene scene;
+
+	// frames per second it asks for, and its share of the 
+	// slaves when they can't keep up with every session
+	double target_fps;
+	double weight;
+
+	// when its next frame is due
+	double next_frame_time;
+	// frames given to slaves and not back yet
+	int frames_in_flight;
+	// its own numbering of its frames, from 1, and the newest delivered
+	unsigned int frames_issued;
+	unsigned int newest_delivered;
+
+	// weighted fair queueing, see SessionScheduler
+	double virtual_time;
+
+	// since the last take_stats: frames delivered, frames delivered 
+	// after a newer one, and frames that were due but never made
+	int frames_delivered;
+	int frames_late;
+	int frames_skipped;
+};
+
+// Shares the slaves among the sessions with start-time fair queueing.
+// A session's virtual time grows by the predicted cost of every frame
+// it is given divided by its weight, and of the sessions with a frame
+// due, the one with the smallest virtual time goes next. When the 
+// slaves can't keep up, each session gets a share of them proportional
+// to its weight, a session asking for less than its share gets every
+// frame it asks for.
+// The scenes are only used by the update thread, the rest is locked
+class SessionScheduler
+{
+public:
+
+	// a session has at most max_in_flight frames out at once
+	SessionScheduler(int max_in_flight);
+
+	// a new table whose first frame is due at 'now', returns its index
+	int add_session(double target_fps, double weight, double now);
+
+	int get_sessions_count() const;
+
+	// the session's table, for the update thread
+	PoolScene& get_scene(int idx);
+
+	// the session whose frame goes next, -1 if no frame is due
+	int pick(double now);
+
+	// the due frame of the session goes to a slave, with this 
+	// predicted cost. Returns the session's number for the frame
+	unsigned int issue(int idx, double now, double cost);
+
+	// a frame of the session came back. Returns false if a newer 
+	// frame of it came back before
+	bool deliver(int idx, unsigned int number);
+
+	// the slave of a frame of the session is done with it,
+	// delivered or not
+	void finish(int idx);
+
+	// copies the session's counters and starts them over
+	Session take_stats(int idx);
+
+private:
+
+	// prevent from copying
+	SessionScheduler(SessionScheduler const& other) = delete;
+	void operator=(SessionScheduler const& other) = delete;
+
+	std::vector<Session> sessions;
+	int max_in_flight;
+
+	// start of the frame given last. A session that was idle 
+	// starts from it, it can't claim the slaves back for the 
+	// time it didn't use them
+	double virtual_now;
+
+	mutable std::mutex mutex;
+};
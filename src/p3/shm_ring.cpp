@@ -0,0 +1,204 @@
+#include "shm_ring.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <iostream>
+
+static const unsigned int shm_magic = 0x44524131; // "DRA1"
+static const int shm_max_slots = 64;
+static const size_t shm_alignment = 64;
+
+static size_t align(size_t size)
+{
+	return (size + shm_alignment - 1) / shm_alignment * shm_alignment;
+}
+
+// at the front of the segment, the slots follow
+struct ShmRing::Layout
+{
+	unsigned int magic;
+	int slot_count;
+	int slot_body_length;
+	int slot_stride;
+	std::atomic<int> in_use[shm_max_slots];
+};
+
+ShmRing* ShmRing::create(const std::string& name, int slot_count, int slot_body_length)
+{
+	if(slot_count <= 0 || slot_count > shm_max_slots)
+		return nullptr;
+
+	size_t stride = align(Message::header_length + slot_body_length);
+	size_t size = align(sizeof(Layout)) + stride * slot_count;
+
+	// a segment left behind by a crashed slave with the same pid
+	shm_unlink(name.c_str());
+
+	int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+	if(fd < 0) {
+		std::cout<<"can't create shared memory "<<name<<std::endl;
+		return nullptr;
+	}
+
+	if(ftruncate(fd, size) != 0) {
+		close(fd);
+		shm_unlink(name.c_str());
+		return nullptr;
+	}
+
+	void* base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(base == MAP_FAILED) {
+		shm_unlink(name.c_str());
+		return nullptr;
+	}
+
+	Layout* layout = static_cast<Layout*>(base);
+	layout->slot_count = slot_count;
+	layout->slot_body_length = slot_body_length;
+	layout->slot_stride = stride;
+	for(int i=0;i<shm_max_slots;i++) {
+		layout->in_use[i].store(0, std::memory_order_relaxed);
+	}
+	std::atomic_thread_fence(std::memory_order_release);
+	layout->magic = shm_magic;
+
+	return new ShmRing(name, static_cast<char*>(base), size, true);
+}
+
+ShmRing* ShmRing::open(const std::string& name)
+{
+	int fd = shm_open(name.c_str(), O_RDWR, 0);
+	if(fd < 0)
+		return nullptr;
+
+	struct stat st;
+	if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(Layout)) {
+		close(fd);
+		return nullptr;
+	}
+
+	size_t size = st.st_size;
+	void* base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(base == MAP_FAILED)
+		return nullptr;
+
+	// make sure the segment is what the slave says it is
+	Layout* layout = static_cast<Layout*>(base);
+	if(layout->magic != shm_magic
+		|| layout->slot_count <= 0 || layout->slot_count > shm_max_slots
+		|| layout->slot_body_length <= 0
+		|| layout->slot_stride < Message::header_length + layout->slot_body_length
+		|| align(sizeof(Layout)) + (size_t)layout->slot_stride * layout->slot_count > size) {
+		munmap(base, size);
+		return nullptr;
+	}
+
+	return new ShmRing(name, static_cast<char*>(base), size, false);
+}
+
+std::string ShmRing::name_for(int pid)
+{
+	return "/dracuda_slave_" + std::to_string(pid);
+}
+
+ShmRing::ShmRing(const std::string& name, char* base, size_t size, bool owner)
+	: name(name), base(base), size(size), owner(owner),
+	  layout(reinterpret_cast<Layout*>(base)), slots(base + align(sizeof(Layout)))
+{
+}
+
+ShmRing::~ShmRing()
+{
+	munmap(base, size);
+	if(owner)
+		shm_unlink(name.c_str());
+}
+
+int ShmRing::get_slot_count() const
+{
+	return layout->slot_count;
+}
+
+int ShmRing::get_slot_body_length() const
+{
+	return layout->slot_body_length;
+}
+
+char* ShmRing::get_slot_data(int slot)
+{
+	return slots + (size_t)slot * layout->slot_stride;
+}
+
+bool ShmRing::is_slot_in_use(int slot) const
+{
+	return layout->in_use[slot].load(std::memory_order_acquire) != 0;
+}
+
+void ShmRing::set_slot_in_use(int slot, bool in_use)
+{
+	layout->in_use[slot].store(in_use ? 1 : 0, std::memory_order_release);
+}
+
+void ShmRing::clear_slots_in_use()
+{
+	for(int i=0;i<layout->slot_count;i++) {
+		set_slot_in_use(i, false);
+	}
+}
+
+ShmMessagePool::ShmMessagePool(ShmRing& ring)
+	: ring(ring)
+{
+	for(int i=0;i<ring.get_slot_count();i++)
+	{
+		Message* msg = new Message(ring.get_slot_data(i), ring.get_slot_body_length(), i);
+		msg->recycler = this;
+		messages.push_back(msg);
+		free_messages.push_back(msg);
+	}
+}
+
+ShmMessagePool::~ShmMessagePool()
+{
+	for(auto msg : messages) {
+		delete msg;
+	}
+}
+
+MessagePtr ShmMessagePool::acquire(int body_length)
+{
+	if(body_length > ring.get_slot_body_length())
+		return MessagePtr();
+
+	Message* msg = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		// the master may still be reading a slot we're done with
+		for(auto it = free_messages.begin(); it != free_messages.end(); ++it)
+		{
+			if(!ring.is_slot_in_use((*it)->shm_slot())) {
+				msg = *it;
+				free_messages.erase(it);
+				break;
+			}
+		}
+	}
+
+	if(!msg)
+		return MessagePtr();
+
+	msg->set_body_length(body_length);
+	return MessagePtr(msg);
+}
+
+void ShmMessagePool::recycle(Message* msg)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	free_messages.push_back(msg);
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "message.hpp"
+
+// A ring of message slots in a POSIX shared memory segment, used
+// between a slave and a master running on the same host.
+// The slave renders straight into a slot, then only sends a 4 bytes
+// doorbell header over the socket naming the slot. The master copies the
+// slot's payload into its frame and hands the slot back, so the pixels
+// never go through the TCP stack.
+//
+// Slot ownership goes through a flag per slot in the segment: the slave
+// sets it before ringing the doorbell, the master clears it once it is
+// done reading the slot.
+class ShmRing
+{
+public:
+
+	// set in a message header, the rest of the header is a slot index
+	// instead of a body length
+	static const int header_flag = 1 << 30;
+
+	// slave -> master : followed by the slave's pid (4 bytes), asks master
+	// to attach to the slave's segment.
+	// master -> slave : master attached, the slots can be used
+	static const int attach_header = header_flag | (header_flag - 1);
+
+	// creates a new segment, owned and unlinked by the returned ring.
+	// Returns nullptr on failure
+	static ShmRing* create(const std::string& name, int slot_count, int slot_body_length);
+
+	// maps the segment created by another process, nullptr on failure
+	static ShmRing* open(const std::string& name);
+
+	// name of the segment of the slave with the given pid
+	static std::string name_for(int pid);
+
+	~ShmRing();
+
+	int get_slot_count() const;
+	int get_slot_body_length() const;
+
+	// a slot holds a whole message : header then body
+	char* get_slot_data(int slot);
+
+	bool is_slot_in_use(int slot) const;
+	void set_slot_in_use(int slot, bool in_use);
+
+	// gives every slot back, when a new master attaches
+	void clear_slots_in_use();
+
+private:
+
+	ShmRing(const std::string& name, char* base, size_t size, bool owner);
+
+	// prevent from copying
+	ShmRing(ShmRing const& other) = delete;
+	void operator=(ShmRing const& other) = delete;
+
+	struct Layout;
+
+	std::string name;
+	char* base;
+	size_t size;
+	bool owner;
+	Layout* layout;
+	char* slots;
+};
+
+// Messages living in the slots of a ShmRing. A message is handed out only
+// if no reader uses its slot anymore, otherwise acquire() fails and the
+// caller falls back to a regular message.
+class ShmMessagePool : public MessageRecycler
+{
+public:
+
+	ShmMessagePool(ShmRing& ring);
+	~ShmMessagePool();
+
+	// returns nullptr if body_length doesn't fit, or every slot is in use
+	MessagePtr acquire(int body_length);
+
+	virtual void recycle(Message* msg);
+
+private:
+
+	// prevent from copying
+	ShmMessagePool(ShmMessagePool const& other) = delete;
+	void operator=(ShmMessagePool const& other) = delete;
+
+	ShmRing& ring;
+	std::vector<Message*> messages; // every message owned by the pool
+	std::vector<Message*> free_messages;
+	std::mutex mutex;
+};
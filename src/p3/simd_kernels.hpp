@@ -0,0 +1,165 @@
+// The vector kernels of the simd renderer, written once for any vector
+// width. raytracer_simd.cpp includes this file with VEC, VEC_WIDTH and
+// the operations (SET1, ADD, ...) defined for SSE, which the renderer
+// uses, and again for AVX2, which only kernel_bench runs for now.
+// The kernels are named after their width: sphereIntersect4, ...
+// They use the renderer's cuScene and cuConstants.
+// Included more than once, on purpose there is no include guard
+
+#define KERNEL_NAME2(name, width) name##width
+#define KERNEL_NAME1(name, width) KERNEL_NAME2(name, width)
+#define KERNEL(name) KERNEL_NAME1(name, VEC_WIDTH)
+
+// the nearest sphere the rays from ray_e along V0 hit. D holds the
+// nearest hit so far and G what it hit, both are left as they are
+// for the rays missing every sphere or hitting them further away
+static inline void KERNEL(sphereIntersect)(float3 ray_e, VEC V0x, VEC V0y, VEC V0z, VEC& D, VEC& G)
+{
+	VEC A, B, C, M0, M1;
+	for (int i = 0; i < SPHERES; i++) {
+		float3 t_ray_e = ray_e - cuScene.ball_position[i];
+		float SC = dot(t_ray_e, t_ray_e) - 1;
+		B = SET1(t_ray_e.x); A = MUL(V0x, B);
+		B = SET1(t_ray_e.y); C = MUL(V0y, B); A = ADD(A, C);
+		B = SET1(t_ray_e.z); C = MUL(V0z, B); A = ADD(A, C); // A = dot(ray_d, t_ray_e)
+		C = A;
+		B = SET1(0);
+		C = SUB(B, C); // C = -B
+		A = MUL(A, A); // A = B2
+		B = SET1(SC);
+		A = SUB(A, B); // A = B2 - C
+		A = SQRT(A); // A = sqrt(B2 - C)
+		C = SUB(C, A); // C = -B - sqrt(B2 - C) == t
+		B = SET1(EPS);
+		M0 = GT(C, B); // M0 = A > B
+		M1 = LT(C, D); // M0 = A > B
+		M0 = AND(M0, M1);
+		A = SET1(i);
+		G = BLEND(G, A, M0); // G is geom
+		D = BLEND(D, C, M0); // D is tmin
+	}
+}
+
+// the same with the planes of the table, returns
+// the mask of the rays that hit one of them
+static inline VEC KERNEL(planeIntersect)(float3 ray_e, VEC V0x, VEC V0y, VEC V0z, VEC& D, VEC& G)
+{
+	VEC A, B, C, M0, M1, M2;
+	M0 = SET1(0);
+	PLANE_INTERSECT(0, y, x, z, V0y, V0x, V0z);
+	PLANE_INTERSECT(1, y, x, z, V0y, V0x, V0z);
+	PLANE_INTERSECT(2, y, x, z, V0y, V0x, V0z);
+	PLANE_INTERSECT(3, y, x, z, V0y, V0x, V0z);
+	PLANE_INTERSECT(4, y, x, z, V0y, V0x, V0z);
+	PLANE_INTERSECT(5, x, y, z, V0x, V0y, V0z);
+	PLANE_INTERSECT(6, x, y, z, V0x, V0y, V0z);
+	PLANE_INTERSECT(7, z, x, y, V0z, V0x, V0y);
+	PLANE_INTERSECT(8, z, x, y, V0z, V0x, V0y);
+	return M0;
+}
+
+// the light the spheres let through to the points V4 from
+// the direction V2, from 0 to 1 with soft edges
+static inline VEC KERNEL(shadowFactor)(VEC V4x, VEC V4y, VEC V4z, VEC V2x, VEC V2y, VEC V2z)
+{
+	VEC A, B, C, E, M0, M1, V3x, V3y, V3z;
+	VEC S = SET1(1.0);
+	for (int j = 0; j < SPHERES; j++) {
+		B = SET1(cuScene.ball_position[j].x); V3x = SUB(V4x, B);
+		B = SET1(cuScene.ball_position[j].y); V3y = SUB(V4y, B);
+		B = SET1(cuScene.ball_position[j].z); V3z = SUB(V4z, B); // V3 = V4 - ballpos = ray_e
+
+		//float3 t_ray_e = ray_e - cuScene.ball_position[j];
+		A = MUL(V2x, V3x);
+		C = MUL(V2y, V3y); A = ADD(A, C);
+		C = MUL(V2z, V3z); A = ADD(A, C); // A = dot(ray_d, ray_e);
+		B = SET1(0); A = SUB(B, A); // A = -dot(ray_d, ray_e);
+		C = MUL(A, A); // C = b * b;
+		B = MUL(V3x, V3x); E = MUL(V3y, V3y);
+		B = ADD(B, E); // B = dot(ray_e, ray_e);
+		E = MUL(V3z, V3z); B = ADD(B, E); B = SUB(B, C); // B = dot - b * b;
+		B = SQRT(B); C = SET1(1.0);
+		B = SUB(B, C); // B = h
+		C = SET1(16.0); B = MUL(B, C); B = DIV(B, A); // B = res
+		E = SET1(0.0);
+		M0 = GT(A, E); M1 = LT(B, E);
+		B = BLEND(B, E, M1);
+
+		M1 = LT(B, S);
+		M0 = AND(M0, M1);
+		S = BLEND(S, B, M0);
+	}
+	return S;
+}
+
+// gamma corrects sums of sample_count samples and writes them at img
+// as 8 bit colors. tempBuffer is room for 24 floats, aligned
+static inline void KERNEL(packPixels)(VEC C2x, VEC C2y, VEC C2z, int sample_count,
+	float* tempBuffer, unsigned char* img)
+{
+	VEC B, M2;
+	C2x = SQRT(C2x);
+	C2y = SQRT(C2y);
+	C2z = SQRT(C2z);
+	B = SET1(1.0 / sqrtf(sample_count));
+	C2x = MUL(C2x, B);
+	C2y = MUL(C2y, B);
+	C2z = MUL(C2z, B);
+
+	B = SET1(1.0);
+	M2 = GT(C2x, B); C2x = BLEND(C2x, B, M2); //CLAMP
+	M2 = GT(C2y, B); C2y = BLEND(C2y, B, M2);
+	M2 = GT(C2z, B); C2z = BLEND(C2z, B, M2);
+	STORE(tempBuffer, C2x);
+	STORE(tempBuffer + 8, C2y);
+	STORE(tempBuffer + 16, C2z);
+	for (int i = 0; i < VEC_WIDTH; i++) {
+		img[3 * i] = 255 * tempBuffer[i];
+		img[3 * i + 1] = 255 * tempBuffer[8 + i];
+		img[3 * i + 2] = 255 * tempBuffer[16 + i];
+	}
+}
+
+// runs a kernel over a set of rays, see kernel_bench.hpp
+static bool KERNEL(runKernel)(BenchKernel kernel, KernelRays& rays, float* tempBuffer)
+{
+	VEC V0x, V0y, V0z, V4x, V4y, V4z, D, G;
+	switch (kernel) {
+	case KERNEL_SPHERES:
+		for (int i = 0; i < rays.count; i += VEC_WIDTH) {
+			V0x = LOAD(rays.dx + i); V0y = LOAD(rays.dy + i); V0z = LOAD(rays.dz + i);
+			D = SET1(10000.0); G = SET1(-1.0);
+			KERNEL(sphereIntersect)(make_float3(rays.ox[i], rays.oy[i], rays.oz[i]), V0x, V0y, V0z, D, G);
+			STORE(rays.t + i, D);
+			STORE(rays.geom + i, G);
+		}
+		return true;
+	case KERNEL_PLANES:
+		for (int i = 0; i < rays.count; i += VEC_WIDTH) {
+			V0x = LOAD(rays.dx + i); V0y = LOAD(rays.dy + i); V0z = LOAD(rays.dz + i);
+			D = SET1(10000.0); G = SET1(-1.0);
+			KERNEL(planeIntersect)(make_float3(rays.ox[i], rays.oy[i], rays.oz[i]), V0x, V0y, V0z, D, G);
+			STORE(rays.t + i, D);
+			STORE(rays.geom + i, G);
+		}
+		return true;
+	case KERNEL_SHADOW:
+		for (int i = 0; i < rays.count; i += VEC_WIDTH) {
+			V0x = LOAD(rays.dx + i); V0y = LOAD(rays.dy + i); V0z = LOAD(rays.dz + i);
+			V4x = LOAD(rays.ox + i); V4y = LOAD(rays.oy + i); V4z = LOAD(rays.oz + i);
+			STORE(rays.t + i, KERNEL(shadowFactor)(V4x, V4y, V4z, V0x, V0y, V0z));
+		}
+		return true;
+	case KERNEL_PACK:
+		// the squared directions make colors of a single sample
+		for (int i = 0; i < rays.count; i += VEC_WIDTH) {
+			V0x = LOAD(rays.dx + i); V0y = LOAD(rays.dy + i); V0z = LOAD(rays.dz + i);
+			KERNEL(packPixels)(MUL(V0x, V0x), MUL(V0y, V0y), MUL(V0z, V0z), 1,
+				tempBuffer, rays.pixels + 3 * i);
+		}
+		return true;
+	default:
+		// the simd renderer runs the other kernels one lane at a time
+		return false;
+	}
+}
@@ -5,19 +5,35 @@
 #include <string>
 #include <cstdlib>
 #include <boost/lexical_cast.hpp>
+#include <algorithm>
+#include <unistd.h>
 
 int Slave::read_msg_max_length = 1000;
 int Slave::write_msg_max_length = 800*600*3;
+int Slave::msg_pool_size = 2;
+bool Slave::use_shm = true;
+
+static const int small_msg_max_length = 256;
+static const int small_msg_pool_size = 4;
+
+static const int reconnect_min_delay_ms = 250;
+static const int reconnect_max_delay_ms = 8000;
+
+// slots still being read by master don't hold back rendering
+static const int shm_extra_slots = 2;
 
 Slave::Slave(boost::asio::io_service& io_service, 
 	tcp::resolver::iterator endpoint_iterator_)
 	: io_service(io_service), endpoint_iterator(endpoint_iterator_),
 	  socket(io_service), read_msg(Slave::read_msg_max_length), 
-	  image_write_msg(new Message(write_msg_max_length))
+	  small_msg_pool(small_msg_max_length, small_msg_pool_size),
+	  image_msg_pool(write_msg_max_length, msg_pool_size),
+	  reconnect_timer(io_service), reconnect_delay_ms(reconnect_min_delay_ms),
+	  connected(false), connection_id(0), shm_attached(false), shm_doorbell(0)
 {
 }
 
-Slave& Slave::start(const std::string& host) 
+Slave& Slave::start(const std::string& host, int port) 
 {
 	using boost::asio::ip::tcp;
 
@@ -26,7 +42,7 @@ Slave& Slave::start(const std::string& host)
 	std::cout<<"starting slave server..."<<std::endl;	
 
 	tcp::resolver resolver(io_service);
-	auto endpoint_iterator = resolver.resolve({ host, boost::lexical_cast<std::string>(50000)}); // 1030 is the port number
+	auto endpoint_iterator = resolver.resolve({ host, boost::lexical_cast<std::string>(port)});
 	static Slave slave(io_service, endpoint_iterator);
 
 	return slave;
@@ -43,6 +59,11 @@ void Slave::run()
 		&io_service));
 }
 
+unsigned int Slave::get_connection_id() const
+{
+	return connection_id.load();
+}
+
 void Slave::do_connect(tcp::resolver::iterator endpoint_iterator)
 {
 	// when we first receive data, we check for the header first
@@ -51,9 +72,88 @@ void Slave::do_connect(tcp::resolver::iterator endpoint_iterator)
 		{
 			if (!ec)
 			{
+				std::cout<<"connected to master"<<std::endl;
+				connected = true;
+				connection_id++;
+				reconnect_delay_ms = reconnect_min_delay_ms;
+				request_shm();
+				if(on_connected) {
+					on_connected();
+				}
 				do_read_header();
 			}
+			else
+			{
+				boost::system::error_code ignored;
+				socket.close(ignored);
+				schedule_reconnect();
+			}
+		});
+}
+
+void Slave::request_shm()
+{
+	if(!use_shm)
+		return;
+
+	// master is on this host if we reach it on loopback or on our own address
+	boost::system::error_code ec_local, ec_remote;
+	auto local = socket.local_endpoint(ec_local).address();
+	auto remote = socket.remote_endpoint(ec_remote).address();
+	if(ec_local || ec_remote || !(remote.is_loopback() || remote == local))
+		return;
+
+	if(!shm_ring) {
+		shm_ring.reset(ShmRing::create(ShmRing::name_for(getpid()), 
+			msg_pool_size + shm_extra_slots, write_msg_max_length));
+		if(!shm_ring)
+			return;
+		shm_msg_pool.reset(new ShmMessagePool(*shm_ring));
+	}
+
+	MessagePtr msg = create_message(sizeof(int));
+	int header = ShmRing::attach_header;
+	int pid = getpid();
+	std::memcpy(msg->data(), &header, sizeof(header));
+	std::memcpy(msg->body(), &pid, sizeof(pid));
+	send(msg);
+}
+
+void Slave::close_and_reconnect(const boost::system::error_code& ec)
+{
+	if(!connected)
+		return;
+
+	std::cout<<"lost connection to master "<<ec<<std::endl;
+
+	connected = false;
+	shm_attached = false;
+	write_msgs.clear();
+	boost::system::error_code ignored;
+	socket.close(ignored);
+
+	if(on_socket_closed) {
+		on_socket_closed();
+	}
+
+	schedule_reconnect();
+}
+
+void Slave::schedule_reconnect()
+{
+	std::cout<<"reconnecting in "<<reconnect_delay_ms<<" ms"<<std::endl;
+
+	reconnect_timer.expires_from_now(boost::posix_time::milliseconds(reconnect_delay_ms));
+	reconnect_timer.async_wait(
+		[this](boost::system::error_code ec)
+		{
+			if (!ec)
+			{
+				do_connect(endpoint_iterator);
+			}
 		});
+
+	reconnect_delay_ms = std::min(reconnect_delay_ms * 2, reconnect_max_delay_ms);
 }
 
 void Slave::do_read_header()
@@ -65,18 +165,25 @@ void Slave::do_read_header()
 		boost::asio::buffer(read_msg.data(), Message::header_length),
 		[this](boost::system::error_code ec, std::size_t /*length*/)
 		{
-			if (!ec && read_msg.decode_header())
+			int header = 0;
+			std::memcpy(&header, read_msg.data(), sizeof(header));
+
+			if (!ec && header == ShmRing::attach_header)
+			{
+				// master attached, slots it didn't give back 
+				// belonged to the previous connection
+				shm_ring->clear_slots_in_use();
+				shm_attached = true;
+				std::cout<<"sending through shared memory"<<std::endl;
+				do_read_header();
+			}
+			else if (!ec && read_msg.decode_header())
 			{
 				do_read_body();
 			}
 			else
 			{
-				std::cout<<"something is wrong. closing socket"<<std::endl;
-				socket.close();
-
-				if(on_socket_closed) {
-					on_socket_closed();
-				}
+				close_and_reconnect(ec);
 			}
 		});
 }
@@ -102,25 +209,20 @@ void Slave::do_read_body()
 			}
 			else
 			{
-				// something is wrong
-				std::cout<<"something is wrong "<<ec<<std::endl;
-				socket.close();
-
-				if(on_socket_closed) {
-					on_socket_closed();
-				}
+				close_and_reconnect(ec);
 			}
 		});
 }
 
 void Slave::send(const unsigned char* chars, int size)
 {
-	// hack
-	// MessagePtr msg = std::make_shared<Message>(size);
-	image_write_msg->set_body_length(size);
-	std::memcpy(image_write_msg->body(), chars, size);
-	image_write_msg->encode_header();
-	send(image_write_msg);
+	// each send gets its own message, so a queued image 
+	// can't be overwritten before it is written
+	MessagePtr msg = create_message(size);
+
+	std::memcpy(msg->body(), chars, size);
+	msg->encode_header();
+	send(msg);
 	//std::cout << "test : " << write_msgs.size() << std::endl;
 }
 
@@ -128,9 +230,8 @@ void Slave::send(const std::string& str)
 {
 	// std::cout<<"trying to send a string"<<std::endl;
 
-	MessagePtr msg = std::make_shared<Message>(str.length());
+	MessagePtr msg = create_message(str.length());
 
-	msg->set_body_length(str.length());
 	std::memcpy(msg->body(), str.c_str(), str.length());
 	msg->encode_header();
 	send(msg);
@@ -141,6 +242,10 @@ void Slave::send(MessagePtr msg)
 	io_service.post(
 	[this, msg]()
 	{
+		// nobody to send to, master will re-issue the work
+		if(!connected)
+			return;
+
 		bool write_in_progress = !write_msgs.empty();
 		write_msgs.push_back(msg);
 		if (!write_in_progress)
@@ -150,15 +255,48 @@ void Slave::send(MessagePtr msg)
 	});
 }
 
+MessagePtr Slave::create_message(int body_length)
+{
+	MessagePtr msg = small_msg_pool.acquire(body_length);
+	if(!msg && shm_attached)
+		msg = shm_msg_pool->acquire(body_length);
+	if(!msg)
+		msg = image_msg_pool.acquire(body_length);
+
+	// too big for any size class
+	if(!msg) {
+		msg = new Message(body_length);
+		msg->set_body_length(body_length);
+	}
+
+	return msg;
+}
+
 void Slave::do_write()
 {
-	boost::asio::async_write(socket,
-		boost::asio::buffer(write_msgs.front()->data(),
-		write_msgs.front()->length()),
-		[this](boost::system::error_code ec, std::size_t /*length*/)
+	unsigned int id = connection_id;
+	MessagePtr& msg = write_msgs.front();
+
+	// the message is already in master's reach, only ring the doorbell.
+	// Without master attached, a slot is sent like any other message
+	auto buffer = boost::asio::buffer(msg->data(), msg->length());
+	if(msg->shm_slot() >= 0 && shm_attached)
+	{
+		shm_ring->set_slot_in_use(msg->shm_slot(), true);
+		shm_doorbell = ShmRing::header_flag | msg->shm_slot();
+		buffer = boost::asio::buffer(&shm_doorbell, sizeof(shm_doorbell));
+	}
+
+	boost::asio::async_write(socket, buffer,
+		[this, id](boost::system::error_code ec, std::size_t /*length*/)
 		{
+			// the queue was dropped with the connection it belonged to
+			if (id != connection_id || !connected)
+				return;
+
 			if (!ec)
 			{
+				// the message goes back to its pool here
 				write_msgs.pop_front();
 				if (!write_msgs.empty())
 				{
@@ -167,12 +305,7 @@ void Slave::do_write()
 			}
 			else
 			{
-				std::cout<<"something is wrong"<<std::endl;
-				socket.close();
-
-				if(on_socket_closed) {
-					on_socket_closed();
-				}
+				close_and_reconnect(ec);
 			}
 		});
 }
@@ -195,6 +328,11 @@ void Slave::set_on_message_received(std::function<void(const Message& message)>
 	on_message_received = cb;	
 }
 
+void Slave::set_on_connected(std::function<void()> const& cb)
+{
+	on_connected = cb;
+}
+
 void Slave::set_on_socket_closed(std::function<void()> const& cb)
 {
 	on_socket_closed = cb;
@@ -1,9 +1,13 @@
 #pragma once
 
 #include <boost/asio.hpp>
+#include <atomic>
 #include <deque>
+#include <memory>
 
 #include "message.hpp"
+#include "message_pool.hpp"
+#include "shm_ring.hpp"
 
 class Slave
 {
@@ -16,8 +20,15 @@ public:
 	static int read_msg_max_length;
 	static int write_msg_max_length;
 
+	// number of preallocated messages per size class
+	static int msg_pool_size;
+
+	// send images through shared memory when master
+	// runs on the same host (see ShmRing)
+	static bool use_shm;
+
 	// create a new thread to run slave tcp 
-	static Slave& start(const std::string& host);
+	static Slave& start(const std::string& host, int port = 50000);
 
 	// stop slave tcp 
 	// FIXME : not completed yet
@@ -28,9 +39,8 @@ public:
 
 	template<typename T>
 	void send(const T& value) {
-		MessagePtr msg =  std::make_shared<Message>(sizeof(T));
+		MessagePtr msg = create_message(sizeof(T));
 
-		msg->set_body_length(sizeof(T));
 		std::memcpy(msg->body(), &value, sizeof(T));
 		msg->encode_header();
 		send(msg);	
@@ -40,10 +50,21 @@ public:
 	void send(const std::string& str);
 	void send(MessagePtr message);
 
+	// returns a message with the given body length, taken from
+	// the pool of its size class when there is one
+	MessagePtr create_message(int body_length);
+
 	void run();
 
+	// increases every time the slave (re)connects to master
+	unsigned int get_connection_id() const;
+
 	// callbacks
 	void set_on_message_received(std::function<void(const Message&)> const& cb);
+	// called every time the slave (re)connects to master
+	void set_on_connected(std::function<void()> const& cb);
+	// called when the connection to master is lost,
+	// the slave then keeps trying to reconnect
 	void set_on_socket_closed(std::function<void()> const& cb);
 
 private:
@@ -51,15 +72,34 @@ private:
 	tcp::socket socket;
 	Message read_msg;
 	MessageQueue write_msgs; // queue to send message
-	// MessageQueue write_msg_pool;
-	MessagePtr image_write_msg; // hack
+	// size classes of the messages slave sends
+	MessagePool small_msg_pool;
+	MessagePool image_msg_pool;
 	tcp::resolver::iterator endpoint_iterator;
 
+	// the image messages live in these slots once master attached
+	std::unique_ptr<ShmRing> shm_ring;
+	std::unique_ptr<ShmMessagePool> shm_msg_pool;
+	std::atomic<bool> shm_attached;
+	// header written for a message sent through a slot
+	int shm_doorbell;
+
+	// reconnecting with exponential backoff
+	boost::asio::deadline_timer reconnect_timer;
+	int reconnect_delay_ms;
+	bool connected;
+	std::atomic<unsigned int> connection_id;
+
 	// callbacks
 	std::function<void(const Message&)> on_message_received;
+	std::function<void()> on_connected;
 	std::function<void()> on_socket_closed;
 	
 	void do_connect(tcp::resolver::iterator endpoint_iterator);
+	// asks master to attach to our slots if it runs on this host
+	void request_shm();
+	void close_and_reconnect(const boost::system::error_code& ec);
+	void schedule_reconnect();
 	void do_read_header();
 	void do_read_body();
 	void do_write();
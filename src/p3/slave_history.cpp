@@ -0,0 +1,150 @@
+#include "slave_history.hpp"
+#include "slave_info.hpp"
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <unistd.h>
+
+// first line of the file, changes with the meaning of the fields.
+// A file with another header is started over
+// 2: network_latency leaves out the time queued and packed on the slave
+static const char* file_header = "dracuda-slave-history 2";
+
+bool SlaveHistory::read_file(const std::string& path, Entries& entries)
+{
+	std::ifstream file(path.c_str());
+	if(!file)
+		return false;
+
+	std::string line;
+	if(!std::getline(file, line) || line != file_header)
+		return false;
+
+	// one host per line, its key and then its estimates
+	while(std::getline(file, line))
+	{
+		std::istringstream fields(line);
+		std::string key;
+		Entry e;
+		if(fields >> key >> e.rendering_factor >> e.rendering_factor_var
+			>> e.network_latency >> e.network_latency_var
+			>> e.reply_bytes >> e.reply_bytes_var >> e.reply_bytes_latency_cov
+			>> e.seconds_per_byte
+			&& e.rendering_factor > 0)
+		{
+			entries[key] = e;
+		}
+	}
+
+	return true;
+}
+
+bool SlaveHistory::load(const std::string& path)
+{
+	Entries loaded;
+	if(!read_file(path, loaded)) {
+		// nothing saved yet
+		std::ifstream file(path.c_str());
+		return !file;
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	for(auto& entry : loaded) {
+		entries[entry.first] = entry.second;
+	}
+	return true;
+}
+
+bool SlaveHistory::save(const std::string& path) const
+{
+	// one save at a time reads and replaces the file
+	std::lock_guard<std::mutex> save_lock(save_mutex);
+
+	Entries merged;
+	read_file(path, merged);
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for(auto& entry : entries) {
+			merged[entry.first] = entry.second;
+		}
+	}
+
+	// written aside first, a run killed while saving doesn't leave
+	// half a file behind. Other runs sharing the file write theirs aside
+	std::ostringstream tmp_path_stream;
+	tmp_path_stream << path << ".tmp." << getpid();
+	std::string tmp_path = tmp_path_stream.str();
+	FILE* file = fopen(tmp_path.c_str(), "w");
+	if(!file)
+		return false;
+
+	fprintf(file, "%s\n", file_header);
+	for(auto& entry : merged)
+	{
+		const Entry& e = entry.second;
+		fprintf(file, "%s %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g\n", entry.first.c_str(),
+			e.rendering_factor, e.rendering_factor_var,
+			e.network_latency, e.network_latency_var,
+			e.reply_bytes, e.reply_bytes_var, e.reply_bytes_latency_cov,
+			e.seconds_per_byte);
+	}
+
+	bool ok = fclose(file) == 0;
+	return ok && rename(tmp_path.c_str(), path.c_str()) == 0;
+}
+
+void SlaveHistory::record(const SlaveInfo& si)
+{
+	// a slave that never answered only has what it was seeded with
+	if(si.messages_received == 0 || si.est_rendering_factor <= 0)
+		return;
+
+	Entry e;
+	e.rendering_factor = si.est_rendering_factor;
+	e.rendering_factor_var = si.est_rendering_factor_var;
+	e.network_latency = si.est_network_latency;
+	e.network_latency_var = si.est_network_latency_var;
+	e.reply_bytes = si.est_reply_bytes;
+	e.reply_bytes_var = si.est_reply_bytes_var;
+	e.reply_bytes_latency_cov = si.est_reply_bytes_latency_cov;
+	e.seconds_per_byte = si.est_seconds_per_byte;
+
+	std::lock_guard<std::mutex> lock(mutex);
+	entries[get_key(si)] = e;
+}
+
+bool SlaveHistory::seed(SlaveInfo& si) const
+{
+	Entry e;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto found = entries.find(get_key(si));
+		if(found == entries.end())
+			return false;
+		e = found->second;
+	}
+
+	si.est_rendering_factor = e.rendering_factor;
+	si.est_rendering_factor_var = e.rendering_factor_var;
+	si.est_network_latency = e.network_latency;
+	si.est_network_latency_var = e.network_latency_var;
+	si.est_reply_bytes = e.reply_bytes;
+	si.est_reply_bytes_var = e.reply_bytes_var;
+	si.est_reply_bytes_latency_cov = e.reply_bytes_latency_cov;
+	si.est_seconds_per_byte = e.seconds_per_byte;
+	si.est_from_history = true;
+	return true;
+}
+
+std::string SlaveHistory::get_key(const SlaveInfo& si)
+{
+	std::ostringstream key;
+	for(const char* c = si.host; *c && c < si.host + sizeof(si.host); c++) {
+		key << (*c == ' ' || *c == '/' ? '_' : *c);
+	}
+	if(!si.host[0])
+		key << "unknown";
+	key << '/' << si.backend << '/' << si.hardware_threads << '/' << si.vector_width;
+	return key.str();
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <string>
+
+struct SlaveInfo;
+
+// The load balancer's estimates of the slaves of past runs, kept in a
+// small text file so a new run plans its first frames with them instead
+// of relearning every slave. Slaves are told apart by their host name
+// and what they render with (see get_key), several slaves on one host
+// share their estimates.
+// Seeded and saved from the update thread, saved again when we end.
+class SlaveHistory
+{
+public:
+
+	// reads the estimates saved at path, a missing file is an
+	// empty history. Returns false if the file can't be read
+	bool load(const std::string& path);
+
+	// writes the estimates to path. Hosts in the file that this
+	// run didn't see are kept, so runs sharing a file add up.
+	// Returns false if the file can't be written
+	bool save(const std::string& path) const;
+
+	// keeps the slave's estimates, if it has any of its own
+	void record(const SlaveInfo& si);
+
+	// puts the estimates of the slave's host into si.
+	// Returns false if there are none
+	bool seed(SlaveInfo& si) const;
+
+	// host name, backend, threads and vector width, without spaces
+	static std::string get_key(const SlaveInfo& si);
+
+private:
+
+	struct Entry
+	{
+		double rendering_factor;
+		double rendering_factor_var;
+		double network_latency;
+		double network_latency_var;
+		double reply_bytes;
+		double reply_bytes_var;
+		double reply_bytes_latency_cov;
+		double seconds_per_byte;
+	};
+
+	typedef std::map<std::string, Entry> Entries;
+
+	static bool read_file(const std::string& path, Entries& entries);
+
+	Entries entries;
+	mutable std::mutex mutex;
+	// held through a whole save
+	mutable std::mutex save_mutex;
+};
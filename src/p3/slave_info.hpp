@@ -1,11 +1,42 @@
+// ping probes the clock offset to a slave is taken from
+static const int CLOCK_PROBES = 8;
+
 struct SlaveInfo
 {
 	int idx;
 
-	int y0;
+	// from the slave's hello
+	int protocol_version;
+	int backend;
+	int hardware_threads;
+	int vector_width;
+	double benchmark_rows_per_second;
+	// zero terminated, empty if the slave didn't tell
+	char host[32];
+
+	// the strip the slave is rendering right now. It is its own
+	// strip (job_strip == idx), or another slave's strip that it was
+	// given speculatively because that slave was straggling
+	int job_strip;
+	int job_y0;
+	int job_height;
+	int job_sample0;
+	int job_sample_count;
+	double job_cost;
+
+	// frame the job belongs to
+	unsigned int job_frame;
+
+	// true once this slave's reply has been written into the frame
+	bool job_delivered;
 
-	// the workload
-	int render_height;
+	// number of strips re-issued to this slave
+	int speculative_jobs;
+
+	// jobs whose result arrived after another slave delivered the
+	// same strip, and the rendering time spent on them
+	int wasted_jobs;
+	double wasted_rendering_time;
 
 	// how many messages have we received 
 	// so far from this slave
@@ -28,6 +59,7 @@ struct SlaveInfo
 	// This value is taken from last frame
 	double rendering_latency;
 
+	// rendering time per unit of predicted row cost
 	// this value is taken from last frame
 	double rendering_factor;
 
@@ -37,6 +69,52 @@ struct SlaveInfo
 
 	double sum_rendering_factor;
 
+	// exponentially weighted estimates of the rendering factor and 
+	// network latency, and of their variance (see LoadBalancer::update_estimates).
+	// Unlike the sums above they follow the slave's current speed
+	double est_rendering_factor;
+	double est_rendering_factor_var;
+	double est_network_latency;
+	double est_network_latency_var;
+
+	// the network latency grows with the size of the reply. 
+	// Fitted from the estimates of the reply size and its
+	// covariance with the network latency
+	double est_reply_bytes;
+	double est_reply_bytes_var;
+	double est_reply_bytes_latency_cov;
+	double est_seconds_per_byte;
+
+	// where the time of the last response went, in seconds (see
+	// record_response in main.cpp): from master sending the job to
+	// the slave receiving it, waiting on the slave before rendering,
+	// from the end of rendering to sending, and from sending to master
+	// receiving it. The one-way latencies need the clock offset
+	double downlink_latency;
+	double queue_time;
+	double pack_time;
+	double uplink_latency;
+
+	// the slave's clock minus ours, from the ping probe with the 
+	// shortest round trip of the last CLOCK_PROBES. Only known once
+	// probes > 0 (see LoadBalancer::update_clock_offset)
+	double clock_offset;
+	double probe_rtt;
+	int probes;
+	double probe_offsets[CLOCK_PROBES];
+	double probe_rtts[CLOCK_PROBES];
+
+	// the estimates were carried over from a previous run (see
+	// SlaveHistory), the first response doesn't replace them
+	bool est_from_history;
+
+	// the load balancer can plan with the estimates, they come from
+	// the slave's responses, a previous run or its benchmark
+	inline bool has_estimates() const
+	{
+		return messages_received > 0 || est_rendering_factor > 0;
+	}
+
 	inline double get_avg_network_latency() const
 	{
 		if(messages_received == 0)
@@ -0,0 +1,230 @@
+#include "tile_stats.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+int TileStats::tile_size = 32;
+
+TileStats::TileStats()
+	: tile_size_used(std::max(4, tile_size / 4 * 4)),
+	columns((WIDTH + tile_size_used - 1) / tile_size_used),
+	rows((HEIGHT + tile_size_used - 1) / tile_size_used),
+	tiles(new Tile[columns * rows])
+{
+	clear();
+}
+
+void TileStats::clear()
+{
+	for(int i=0;i<columns * rows;i++)
+	{
+		tiles[i].ticks = 0;
+		tiles[i].pixels = 0;
+		tiles[i].primary_rays = 0;
+		tiles[i].shadow_rays = 0;
+	}
+}
+
+int TileStats::get_tile_width(int column) const
+{
+	return std::min(tile_size_used, WIDTH - column * tile_size_used);
+}
+
+int TileStats::get_tile_height(int row) const
+{
+	return std::min(tile_size_used, HEIGHT - row * tile_size_used);
+}
+
+void TileStats::add(int column, int row, unsigned long long ticks, unsigned long long pixels,
+	unsigned long long primary_rays, unsigned long long shadow_rays)
+{
+	if(column < 0 || column >= columns || row < 0 || row >= rows)
+		return;
+
+	Tile& tile = tiles[row * columns + column];
+	tile.ticks.fetch_add(ticks, std::memory_order_relaxed);
+	tile.pixels.fetch_add(pixels, std::memory_order_relaxed);
+	tile.primary_rays.fetch_add(primary_rays, std::memory_order_relaxed);
+	tile.shadow_rays.fetch_add(shadow_rays, std::memory_order_relaxed);
+}
+
+bool TileStats::write_csv(const std::string& path) const
+{
+	FILE* file = fopen(path.c_str(), "w");
+	if(!file)
+		return false;
+
+	fprintf(file, "column,row,x0,y0,width,height,ticks,pixels,primary_rays,shadow_rays,ticks_per_pixel,ticks_per_ray\n");
+	for(int r=0;r<rows;r++)
+	{
+		for(int c=0;c<columns;c++)
+		{
+			const Tile& tile = tiles[r * columns + c];
+			unsigned long long ticks = tile.ticks;
+			unsigned long long pixels = tile.pixels;
+			unsigned long long rays = tile.primary_rays + tile.shadow_rays;
+
+			fprintf(file, "%d,%d,%d,%d,%d,%d,%llu,%llu,%llu,%llu,%.1f,%.2f\n",
+				c, r, c * tile_size_used, r * tile_size_used, get_tile_width(c), get_tile_height(r),
+				ticks, pixels, (unsigned long long)tile.primary_rays, (unsigned long long)tile.shadow_rays,
+				pixels > 0 ? (double)ticks / pixels : 0.0, rays > 0 ? (double)ticks / rays : 0.0);
+		}
+	}
+
+	fclose(file);
+	return true;
+}
+
+// black, red, yellow, white as cost goes from 0 to 1
+static void heat_color(double cost, unsigned char* rgb)
+{
+	cost = std::max(0.0, std::min(1.0, cost)) * 3;
+	rgb[0] = 255 * std::min(1.0, cost);
+	rgb[1] = 255 * std::max(0.0, std::min(1.0, cost - 1));
+	rgb[2] = 255 * std::max(0.0, std::min(1.0, cost - 2));
+}
+
+bool TileStats::write_heatmap(const std::string& path) const
+{
+	// the tiles that weren't rendered are as cheap as can be
+	std::vector<double> cost(columns * rows);
+	for(int i=0;i<columns * rows;i++) {
+		unsigned long long pixels = tiles[i].pixels;
+		cost[i] = pixels > 0 ? (double)tiles[i].ticks / pixels : 0;
+	}
+	double lowest = *std::min_element(cost.begin(), cost.end());
+	double highest = *std::max_element(cost.begin(), cost.end());
+	double range = highest > lowest ? highest - lowest : 1;
+
+	FILE* file = fopen(path.c_str(), "wb");
+	if(!file)
+		return false;
+
+	// top row first, the frame's rows go up from the bottom
+	std::vector<unsigned char> line(WIDTH * PIXEL_SIZE);
+	fprintf(file, "P6\n%d %d\n255\n", WIDTH, HEIGHT);
+	for(int y=HEIGHT-1;y>=0;y--)
+	{
+		int r = y / tile_size_used;
+		for(int x=0;x<WIDTH;x++)
+		{
+			int c = x / tile_size_used;
+			heat_color((cost[r * columns + c] - lowest) / range, &line[x * PIXEL_SIZE]);
+
+			// a dark line around the tiles
+			if(x % tile_size_used == 0 || y % tile_size_used == 0) {
+				for(int k=0;k<PIXEL_SIZE;k++) {
+					line[x * PIXEL_SIZE + k] /= 2;
+				}
+			}
+		}
+		fwrite(line.data(), 1, line.size(), file);
+	}
+
+	fclose(file);
+	return true;
+}
+
+StripMap::StripMap()
+{
+}
+
+void StripMap::add(int y0, int height, int slave, const char* host, double rendering_latency)
+{
+	Strip strip;
+	strip.y0 = y0;
+	strip.height = height;
+	strip.slave = slave;
+	strip.host = host;
+	strip.rendering_latency = rendering_latency;
+
+	std::lock_guard<std::mutex> lock(mutex);
+	assembly.push_back(strip);
+}
+
+void StripMap::complete_frame(const unsigned char* pixels)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	strips.swap(assembly);
+	assembly.clear();
+	std::sort(strips.begin(), strips.end(),
+		[](const Strip& a, const Strip& b) { return a.y0 < b.y0; });
+	frame.assign(pixels, pixels + WIDTH * HEIGHT * PIXEL_SIZE);
+}
+
+bool StripMap::write_csv(const std::string& path) const
+{
+	FILE* file = fopen(path.c_str(), "w");
+	if(!file)
+		return false;
+
+	std::lock_guard<std::mutex> lock(mutex);
+	fprintf(file, "y0,height,slave,host,rendering_ms\n");
+	for(const Strip& strip : strips) {
+		fprintf(file, "%d,%d,%d,%s,%.3f\n", strip.y0, strip.height, strip.slave,
+			strip.host.c_str(), strip.rendering_latency * 1000);
+	}
+
+	fclose(file);
+	return true;
+}
+
+// a color of slave-i's, far from its neighbours'
+static void slave_color(int slave, unsigned char* rgb)
+{
+	static const unsigned char palette[][3] = {
+		{230, 25, 75}, {60, 180, 75}, {255, 225, 25}, {0, 130, 200},
+		{245, 130, 48}, {145, 30, 180}, {70, 240, 240}, {240, 50, 230},
+		{210, 245, 60}, {250, 190, 190}
+	};
+	const int colors = sizeof(palette) / sizeof(palette[0]);
+	const unsigned char* color = palette[std::max(0, slave) % colors];
+	rgb[0] = color[0];
+	rgb[1] = color[1];
+	rgb[2] = color[2];
+}
+
+bool StripMap::write_image(const std::string& path) const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if(frame.empty())
+		return false;
+
+	// the slave of each row, -1 if no strip covered it
+	std::vector<int> row_slave(HEIGHT, -1);
+	std::vector<bool> row_edge(HEIGHT, false);
+	for(const Strip& strip : strips) {
+		for(int y=std::max(0, strip.y0);y<std::min(HEIGHT, strip.y0 + strip.height);y++) {
+			row_slave[y] = strip.slave;
+		}
+		if(strip.y0 >= 0 && strip.y0 < HEIGHT)
+			row_edge[strip.y0] = true;
+	}
+
+	FILE* file = fopen(path.c_str(), "wb");
+	if(!file)
+		return false;
+
+	// top row first, the frame's rows go up from the bottom
+	std::vector<unsigned char> line(WIDTH * PIXEL_SIZE);
+	fprintf(file, "P6\n%d %d\n255\n", WIDTH, HEIGHT);
+	for(int y=HEIGHT-1;y>=0;y--)
+	{
+		const unsigned char* row = &frame[y * WIDTH * PIXEL_SIZE];
+		unsigned char tint[3] = {0, 0, 0};
+		if(row_slave[y] >= 0)
+			slave_color(row_slave[y], tint);
+
+		for(int x=0;x<WIDTH;x++) {
+			for(int k=0;k<PIXEL_SIZE;k++) {
+				line[x * PIXEL_SIZE + k] = row_edge[y] ? 255
+					: (row[x * PIXEL_SIZE + k] + tint[k % 3]) / 2;
+			}
+		}
+		fwrite(line.data(), 1, line.size(), file);
+	}
+
+	fclose(file);
+	return true;
+}
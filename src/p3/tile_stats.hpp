@@ -0,0 +1,118 @@
+#pragma once
+
+#include "constants.hpp"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// What rendering each tile of the frame cost, measured by the CPU
+// renderers when they are given one (see simdTileStats and
+// singleTileStats): CycleTimer ticks, primary rays and shadow rays.
+// Tiles are tile_size pixels square in frame coordinates, so strips
+// rendered by different slaves land in the same grid. The last tiles
+// of a row or a column may be smaller. The costs add up over the
+// frames rendered until clear is called
+class TileStats
+{
+public:
+
+	// a multiple of 4, the simd renderer's packets of pixels
+	static int tile_size;
+
+	TileStats();
+
+	void clear();
+
+	int get_tile_size() const { return tile_size_used; }
+	int get_columns() const { return columns; }
+	int get_rows() const { return rows; }
+
+	// width and height of a tile in pixels
+	int get_tile_width(int column) const;
+	int get_tile_height(int row) const;
+
+	// adds the cost of some of a tile's pixels, safe to
+	// call from several threads
+	void add(int column, int row, unsigned long long ticks, unsigned long long pixels,
+		unsigned long long primary_rays, unsigned long long shadow_rays);
+
+	// one line per tile: where it is, its ticks, pixels rendered and rays
+	// and the ticks per pixel and per ray. Returns false if it can't be written
+	bool write_csv(const std::string& path) const;
+
+	// a frame sized ppm, each tile colored by its ticks per pixel from
+	// black (the cheapest tile) through red and yellow to white (the
+	// most costly). Returns false if it can't be written
+	bool write_heatmap(const std::string& path) const;
+
+private:
+
+	// prevent from copying
+	TileStats(TileStats const& other) = delete;
+	void operator=(TileStats const& other) = delete;
+
+	struct Tile
+	{
+		std::atomic<unsigned long long> ticks;
+		std::atomic<unsigned long long> pixels;
+		std::atomic<unsigned long long> primary_rays;
+		std::atomic<unsigned long long> shadow_rays;
+	};
+
+	int tile_size_used;
+	int columns;
+	int rows;
+	std::unique_ptr<Tile[]> tiles;
+};
+
+// Which slave rendered which strip of the frames the master
+// assembles out of rows. The strips are added as they are delivered
+// and the map of the frame is kept once it is complete, with a copy
+// of its pixels, until the next frame is
+class StripMap
+{
+public:
+
+	StripMap();
+
+	// a strip of the frame being assembled, safe to call from several threads
+	void add(int y0, int height, int slave, const char* host, double rendering_latency);
+
+	// the frame being assembled is complete, frame is its pixels
+	void complete_frame(const unsigned char* frame);
+
+	bool empty() const { return frame.empty(); }
+
+	// one line per strip of the last complete frame: its rows, the
+	// slave and host that rendered it and how long it took.
+	// Returns false if it can't be written
+	bool write_csv(const std::string& path) const;
+
+	// a ppm of the last complete frame, each strip tinted with a color
+	// of its slave's and a line between strips. Returns false if it
+	// can't be written
+	bool write_image(const std::string& path) const;
+
+private:
+
+	// prevent from copying
+	StripMap(StripMap const& other) = delete;
+	void operator=(StripMap const& other) = delete;
+
+	struct Strip
+	{
+		int y0;
+		int height;
+		int slave;
+		std::string host;
+		double rendering_latency;
+	};
+
+	mutable std::mutex mutex;
+	std::vector<Strip> assembly;
+	std::vector<Strip> strips;
+	std::vector<unsigned char> frame;
+};